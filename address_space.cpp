@@ -0,0 +1,16 @@
+#include "address_space.h"
+#include "exception.h"
+#include "snapshot.h"
+
+AddressSpace::AddressSpace() :
+    addressSpace_(
+            throwUnwindIf0(unw_create_addr_space(snapshotAccessors(), 0)),
+            &unw_destroy_addr_space)
+{
+    throwUnwindIfLessThan0(unw_set_caching_policy(
+                addressSpace_.get(), UNW_CACHE_PER_THREAD));
+}
+
+void AddressSpace::flush() {
+    unw_flush_cache(addressSpace_.get(), 0, 0);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <memory>
+
+#include <libunwind.h>
+
+// Remote libunwind address space shared by all threads of the traced
+// process. Unwind info lookups are cached per unwinding thread.
+class AddressSpace {
+public:
+    AddressSpace();
+
+    unw_addr_space_t get() const { return addressSpace_.get(); }
+
+    // Must be called when the target's mappings change,
+    // but not while some thread is unwinding.
+    void flush();
+
+private:
+    std::unique_ptr<
+        struct unw_addr_space,
+        void (*)(unw_addr_space_t)> addressSpace_;
+};
@@ -0,0 +1,153 @@
+#include "async_tracer.h"
+#include "exception.h"
+
+#include <boost/format.hpp>
+
+#include <iostream>
+
+#include <signal.h>
+#include <sys/eventfd.h>
+
+AsyncTracer::AsyncTracer(std::unique_ptr<Tracer> tracer, size_t capacity) :
+    tracer_(std::move(tracer)),
+    queue_(capacity),
+    wakeup_(throwErrnoIfMinus1(eventfd(0, EFD_CLOEXEC))),
+    ticks_(0),
+    dropped_(0),
+    maxQueued_(0),
+    isStopping_(false),
+    isFailed_(false),
+    thread_([this] { run(); })
+{}
+
+AsyncTracer::~AsyncTracer() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        isStopping_ = true;
+    }
+    notify();
+    thread_.join();
+    if (error_) {
+        // Never got to the event loop, which is gone by now.
+        try {
+            std::rethrow_exception(error_);
+        } catch (const std::exception& e) {
+            std::cerr << "Exception: " << e.what() << std::endl;
+        }
+    }
+}
+
+void AsyncTracer::tick(const SampleBatch& batch) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (error_) {
+            auto error = error_;
+            error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+    ++ticks_;
+    if (!queue_.push(batch)) {
+        ++dropped_;
+        return;
+    }
+    size_t queued = queue_.size();
+    if (queued > maxQueued_.load()) {
+        maxQueued_.store(queued);
+    }
+    notify();
+}
+
+void AsyncTracer::addInfoLine(const std::string& info) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        infoLines_.push_back(info);
+    }
+    notify();
+}
+
+void AsyncTracer::setStatus(
+        const std::string& name, const std::string& value) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        statuses_.emplace_back(name, value);
+    }
+    notify();
+}
+
+void AsyncTracer::notify() {
+    uint64_t one = 1;
+    throwErrnoIfMinus1(write(wakeup_.get(), &one, sizeof(one)));
+}
+
+void AsyncTracer::run() {
+    // Signals are the business of the event loop.
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    for (;;) {
+        uint64_t posts;
+        if (read(wakeup_.get(), &posts, sizeof(posts)) == -1 &&
+                errno != EINTR) {
+            return;
+        }
+        try {
+            if (!drain()) {
+                return;
+            }
+        } catch (const std::exception&) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            error_ = std::current_exception();
+            isFailed_ = true;
+        }
+    }
+}
+
+bool AsyncTracer::drain() {
+    std::vector<std::string> infoLines;
+    std::vector<std::pair<std::string, std::string>> statuses;
+    bool isStopping;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        infoLines.swap(infoLines_);
+        statuses.swap(statuses_);
+        isStopping = isStopping_;
+    }
+    if (isFailed_) {
+        // Only waiting to be stopped, the error says it all.
+        while (queue_.front()) {
+            queue_.pop();
+        }
+        return !isStopping;
+    }
+    for (const auto& info: infoLines) {
+        tracer_->addInfoLine(info);
+    }
+    for (const auto& status: statuses) {
+        tracer_->setStatus(status.first, status.second);
+    }
+    // The producer only pushes, so the batches are there for good.
+    while (const SampleBatch* batch = queue_.front()) {
+        auto start = std::chrono::steady_clock::now();
+        tracer_->tick(*batch);
+        tickDurations_.record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+        queue_.pop();
+    }
+    reportPipeline();
+    return !isStopping;
+}
+
+void AsyncTracer::reportPipeline() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastReport_ < std::chrono::seconds(1)) {
+        return;
+    }
+    lastReport_ = now;
+    tracer_->setStatus("pipeline", str(boost::format(
+                    "%d of %d ticks dropped, up to %d of %d queued") %
+                dropped_.load() % ticks_.load() %
+                maxQueued_.load() % queue_.capacity()));
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "batch_queue.h"
+#include "file_descriptor.h"
+#include "histogram.h"
+#include "tracer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Runs a tracer on a thread of its own, so that aggregating and
+// rendering never delay the next beat. Ticks are handed over through a
+// BatchQueue; a tracer falling a whole queue behind loses ticks rather
+// than holding up sampling, and the losses are reported as its
+// "pipeline" status.
+class AsyncTracer : public Tracer {
+public:
+    AsyncTracer(std::unique_ptr<Tracer> tracer, size_t capacity);
+    // Lets the tracer finish the ticks queued so far.
+    ~AsyncTracer();
+
+    // Rethrows what the tracer has thrown since the last call.
+    void tick(const SampleBatch& batch) override;
+    void addInfoLine(const std::string& info) override;
+    void setStatus(
+            const std::string& name, const std::string& value) override;
+
+    // Time the tracer takes per tick, in nanoseconds.
+    const Histogram& tickDurations() const { return tickDurations_; }
+
+private:
+    void notify();
+    void run();
+    // Passes on what has been posted, returns false once stopped and
+    // drained.
+    bool drain();
+    void reportPipeline();
+
+    std::unique_ptr<Tracer> tracer_;
+    BatchQueue queue_;
+    // Counts the posts not yet seen by the tracer thread.
+    FileDescriptor wakeup_;
+
+    // Written by the producer only.
+    std::atomic<uint64_t> ticks_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<size_t> maxQueued_;
+    // Written by the tracer thread only.
+    Histogram tickDurations_;
+
+    std::mutex mutex_;
+    std::vector<std::string> infoLines_;
+    std::vector<std::pair<std::string, std::string>> statuses_;
+    std::exception_ptr error_;
+    bool isStopping_;
+
+    // Tracer thread only.
+    bool isFailed_;
+    std::chrono::steady_clock::time_point lastReport_;
+
+    std::thread thread_;
+};
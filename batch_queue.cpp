@@ -0,0 +1,35 @@
+#include "batch_queue.h"
+
+BatchQueue::BatchQueue(size_t capacity) :
+    slots_(capacity),
+    pushed_(0),
+    popped_(0)
+{}
+
+bool BatchQueue::push(const SampleBatch& batch) {
+    uint64_t pushed = pushed_.load(std::memory_order_relaxed);
+    if (pushed - popped_.load(std::memory_order_acquire) == slots_.size()) {
+        return false;
+    }
+    slots_[pushed % slots_.size()] = batch;
+    pushed_.store(pushed + 1, std::memory_order_release);
+    return true;
+}
+
+const SampleBatch* BatchQueue::front() const {
+    uint64_t popped = popped_.load(std::memory_order_relaxed);
+    if (popped == pushed_.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    return &slots_[popped % slots_.size()];
+}
+
+void BatchQueue::pop() {
+    popped_.store(popped_.load(std::memory_order_relaxed) + 1,
+            std::memory_order_release);
+}
+
+size_t BatchQueue::size() const {
+    uint64_t popped = popped_.load(std::memory_order_acquire);
+    return pushed_.load(std::memory_order_acquire) - popped;
+}
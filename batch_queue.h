@@ -0,0 +1,37 @@
+#pragma once
+
+#include "sample_batch.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Bounded queue of sample batches between a single producer and a single
+// consumer, neither of which ever waits for the other. Slots are reused,
+// so copying batches in stops allocating once every slot has seen the
+// largest tick.
+class BatchQueue {
+public:
+    explicit BatchQueue(size_t capacity);
+
+    // Producer side. Copies the batch in, returns false if the queue is
+    // full.
+    bool push(const SampleBatch& batch);
+
+    // Consumer side. The oldest batch, or nullptr if the queue is empty.
+    // Valid until pop().
+    const SampleBatch* front() const;
+    void pop();
+
+    // Exact on either side, a snapshot from anywhere else.
+    size_t size() const;
+    size_t capacity() const { return slots_.size(); }
+
+private:
+    std::vector<SampleBatch> slots_;
+    // Batch n lives in slot n % capacity. Each counter is written by
+    // one side only, padded apart to keep them off the same cache line.
+    std::atomic<uint64_t> pushed_;
+    char padding_[64];
+    std::atomic<uint64_t> popped_;
+};
@@ -0,0 +1,13 @@
+// Built once per LIBRARY_INDEX into libwatbenchN.so, so that the
+// benchmark target spreads its time over that many libraries.
+
+#include <cstdint>
+
+extern "C" uint64_t watbench_work(uint64_t x) {
+    // Enough to take about a microsecond, differing per library.
+    for (int i = 0; i != 256; ++i) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull +
+            LIBRARY_INDEX;
+    }
+    return x;
+}
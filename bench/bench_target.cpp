@@ -0,0 +1,186 @@
+// Synthetic target for wat_bench. Every thread calls down to a given
+// depth and then alternates between busy and idle within each
+// millisecond, calling into the benchmark libraries round-robin while
+// busy. Work done by all the threads is counted in a shared file, so
+// that the driver can tell how much a profiler slows the target down.
+
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+typedef uint64_t (*WorkFunction)(uint64_t);
+
+struct Config {
+    int threads = 8;
+    int depth = 16;
+    int idlePercent = 50;
+    int libraries = 4;
+    std::string counterPath;
+};
+
+const int MAX_LIBRARIES = 8;
+const std::chrono::microseconds CYCLE(1000);
+
+Config config;
+std::vector<WorkFunction> functions;
+std::atomic<uint64_t>* counter;
+// Keeps the work from being optimized away.
+std::atomic<uint64_t> sink;
+
+uint64_t localWork(uint64_t x) {
+    for (int i = 0; i != 256; ++i) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    return x;
+}
+
+void usage(const char* argv0) {
+    std::cerr << boost::format(
+            "Usage: %s [-t threads] [-d depth] [-i idle_percent] "
+                "[-l libraries] [-c counter_file]\n"
+            "  -t  busy threads (default: %d)\n"
+            "  -d  frames on every stack below the thread function\n"
+            "      (default: %d)\n"
+            "  -i  percentage of time spent sleeping (default: %d)\n"
+            "  -l  libraries to spread the work over, up to %d\n"
+            "      (default: %d)\n"
+            "  -c  count work done in the first 8 bytes of that file\n") %
+        argv0 % config.threads % config.depth % config.idlePercent %
+        MAX_LIBRARIES % config.libraries;
+}
+
+void loadLibraries(const char* argv0) {
+    char self[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length < 0) {
+        throw std::runtime_error("can't read /proc/self/exe");
+    }
+    self[length] = '\0';
+    std::string dir = dirname(self);
+    for (int i = 0; i != config.libraries; ++i) {
+        std::string path = str(
+                boost::format("%s/libwatbench%d.so") % dir % i);
+        void* library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!library) {
+            throw std::runtime_error(std::string(argv0) + ": " + dlerror());
+        }
+        functions.push_back(reinterpret_cast<WorkFunction>(
+                    dlsym(library, "watbench_work")));
+        if (!functions.back()) {
+            throw std::runtime_error(path + ": no watbench_work");
+        }
+    }
+}
+
+void work() {
+    auto busy = CYCLE * (100 - config.idlePercent) / 100;
+    uint64_t x = reinterpret_cast<uintptr_t>(&x);
+    size_t next = 0;
+    for (;;) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t units = 0;
+        do {
+            x = functions.empty() ?
+                localWork(x) :
+                functions[next++ % functions.size()](x);
+            ++units;
+        } while (std::chrono::steady_clock::now() - start < busy);
+        sink.fetch_add(x, std::memory_order_relaxed);
+        if (counter) {
+            counter->fetch_add(units, std::memory_order_relaxed);
+        }
+        if (busy < CYCLE) {
+            std::this_thread::sleep_until(start + CYCLE);
+        }
+    }
+}
+
+__attribute__((noinline)) void descend(int depth) {
+    if (depth > 0) {
+        descend(depth - 1);
+        // Not a tail call, so that every frame stays on the stack.
+        asm volatile("");
+    } else {
+        work();
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        int opt;
+        while ((opt = getopt(argc, argv, "t:d:i:l:c:")) != -1) {
+            switch (opt) {
+                case 't':
+                    config.threads = boost::lexical_cast<int>(optarg);
+                    break;
+                case 'd':
+                    config.depth = boost::lexical_cast<int>(optarg);
+                    break;
+                case 'i':
+                    config.idlePercent = boost::lexical_cast<int>(optarg);
+                    break;
+                case 'l':
+                    config.libraries = boost::lexical_cast<int>(optarg);
+                    break;
+                case 'c':
+                    config.counterPath = optarg;
+                    break;
+                default:
+                    usage(argv[0]);
+                    return 1;
+            }
+        }
+        if (optind != argc || config.threads < 1 || config.depth < 0 ||
+                config.idlePercent < 0 || config.idlePercent > 99 ||
+                config.libraries < 0 || config.libraries > MAX_LIBRARIES) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        loadLibraries(argv[0]);
+        if (!config.counterPath.empty()) {
+            int fd = open(config.counterPath.c_str(), O_RDWR | O_CLOEXEC);
+            void* memory = fd == -1 || ftruncate(fd, sizeof(*counter)) ?
+                MAP_FAILED :
+                mmap(nullptr, sizeof(*counter), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+            if (memory == MAP_FAILED) {
+                throw std::runtime_error("can't map " + config.counterPath);
+            }
+            close(fd);
+            counter = static_cast<std::atomic<uint64_t> *>(memory);
+        }
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i != config.threads; ++i) {
+            threads.emplace_back([] { descend(config.depth); });
+        }
+        for (auto& thread: threads) {
+            thread.join();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,308 @@
+// Runs wat against bench_target and reports what it costs, one
+// "name key=value..." line each, like `wat -S` does:
+//   config      the target and wat settings
+//   rate        samples a second asked for and actually taken
+//   stop_latency_ns, stopped_ns
+//               per sample, from wat's own statistics
+//   throughput  target work units a second without and with wat
+//   wat         its CPU time and peak RSS
+//   attach, detach
+//               until every thread is traced, and from SIGINT
+//               until wat has exited, having detached
+// The target is measured alone first, then with wat attached.
+
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+typedef std::map<std::string, std::map<std::string, std::string>> Stats;
+
+struct Config {
+    std::string wat = "./wat";
+    std::string target = "bench/bench_target";
+    std::vector<std::string> watArgs;
+    // Option letters and values.
+    std::vector<std::pair<char, std::string>> targetOptions;
+    double seconds = 5;
+    int frequency = 1000;
+};
+
+// Like throwErrnoIfMinus1 of wat, which needs libunwind.
+int check(int ret) {
+    if (ret == -1) {
+        throw std::system_error(errno, std::system_category());
+    }
+    return ret;
+}
+
+void usage(const char* argv0) {
+    std::cerr << boost::format(
+            "Usage: %s [-w wat] [-T target] [-s seconds] [-H hz] "
+                "[-a wat_option]...\n"
+            "           [-t threads] [-d depth] [-i idle_percent] "
+                "[-l libraries]\n"
+            "  -w  wat to run (default: ./wat)\n"
+            "  -T  target to run (default: bench/bench_target)\n"
+            "  -s  seconds to measure for, with and without wat\n"
+            "      (default: 5)\n"
+            "  -H  sampling rate to ask wat for (default: 1000)\n"
+            "  -a  pass that to wat, may be repeated\n"
+            "  -t, -d, -i, -l\n"
+            "      passed to the target, see bench_target -h\n") %
+        argv0;
+}
+
+pid_t spawn(const std::vector<std::string>& args) {
+    std::vector<char*> argv;
+    for (const auto& arg: args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    pid_t pid = check(fork());
+    if (!pid) {
+        execv(argv[0], argv.data());
+        std::cerr << "Can't run " << args[0] << std::endl;
+        _exit(127);
+    }
+    return pid;
+}
+
+const char* targetOptionName(char option) {
+    switch (option) {
+        case 't':
+            return "threads";
+        case 'd':
+            return "depth";
+        case 'i':
+            return "idle_percent";
+        case 'l':
+            return "libraries";
+    }
+    return "unknown";
+}
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Work units done by the target a second, over seconds from now.
+double throughput(const std::atomic<uint64_t>* counter, double seconds) {
+    uint64_t before = counter->load();
+    auto start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    return (counter->load() - before) / secondsSince(start);
+}
+
+Stats readStats(const std::string& path) {
+    Stats stats;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        boost::split(fields, line, boost::is_any_of(" "));
+        for (size_t i = 1; i < fields.size(); ++i) {
+            auto equals = fields[i].find('=');
+            if (equals != std::string::npos) {
+                stats[fields[0]][fields[i].substr(0, equals)] =
+                    fields[i].substr(equals + 1);
+            }
+        }
+    }
+    if (stats.empty()) {
+        throw std::runtime_error("wat has written no stats to " + path);
+    }
+    return stats;
+}
+
+bool isTraced(pid_t pid) {
+    std::ifstream status(str(boost::format("/proc/%d/status") % pid));
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 10, "TracerPid:") == 0) {
+            return atoi(line.c_str() + 10) != 0;
+        }
+    }
+    return false;
+}
+
+void run(const Config& config) {
+    char counterPath[] = "/tmp/wat_bench.XXXXXX";
+    int fd = check(mkstemp(counterPath));
+    unlink(counterPath);
+    std::string counterProcPath = str(
+            boost::format("/proc/%d/fd/%d") % getpid() % fd);
+    check(ftruncate(fd, sizeof(uint64_t)));
+    void* memory = mmap(nullptr, sizeof(uint64_t), PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        check(-1);
+    }
+    auto* counter = static_cast<std::atomic<uint64_t> *>(memory);
+
+    std::vector<std::string> targetArgs{config.target};
+    for (const auto& option: config.targetOptions) {
+        targetArgs.push_back(std::string("-") + option.first);
+        targetArgs.push_back(option.second);
+    }
+    targetArgs.push_back("-c");
+    targetArgs.push_back(counterProcPath);
+    pid_t target = spawn(targetArgs);
+    struct TargetKiller {
+        pid_t pid;
+        ~TargetKiller() {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+    } killer{target};
+
+    // Warming up.
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    if (waitpid(target, nullptr, WNOHANG) != 0) {
+        throw std::runtime_error("the target has failed to start");
+    }
+    double baseline = throughput(counter, config.seconds);
+
+    std::string statsPath = str(
+            boost::format("/tmp/wat_bench.%d.stats") % getpid());
+    std::vector<std::string> watArgs{config.wat, "-n", "-f", "/dev/null",
+        "-S", statsPath, "-H", std::to_string(config.frequency)};
+    watArgs.insert(watArgs.end(),
+            config.watArgs.begin(), config.watArgs.end());
+    watArgs.push_back(std::to_string(target));
+    auto watStart = Clock::now();
+    pid_t wat = spawn(watArgs);
+
+    // Attaching takes a while, measuring after it.
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    double profiled = throughput(counter, config.seconds);
+
+    auto stopStart = Clock::now();
+    double watSeconds = secondsSince(watStart);
+    check(kill(wat, SIGINT));
+    int status;
+    struct rusage usage;
+    check(wait4(wat, &status, 0, &usage));
+    double detachSeconds = secondsSince(stopStart);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        throw std::runtime_error("wat has failed");
+    }
+    bool isDetached = !isTraced(target);
+
+    auto stats = readStats(statsPath);
+    unlink(statsPath.c_str());
+    double attachSeconds =
+        boost::lexical_cast<double>(stats["attach"]["ns"]) / 1e9;
+    double ticks = boost::lexical_cast<double>(
+            stats["tracers_enqueue_ns"]["count"]);
+    double cpuSeconds =
+        usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+    // Options left out are at the target's defaults.
+    std::cout << "config";
+    for (const auto& option: config.targetOptions) {
+        std::cout << " " << targetOptionName(option.first) << "=" <<
+            option.second;
+    }
+    std::cout << boost::format(" seconds=%g hz=%d wat_args=%s\n") %
+        config.seconds %
+        config.frequency %
+        boost::algorithm::join(config.watArgs, ",");
+    std::cout << boost::format("rate requested_hz=%d achieved_hz=%.1f\n") %
+        config.frequency %
+        (ticks / std::max(watSeconds - attachSeconds, 1e-9));
+    for (const char* name: {
+            "stop_latency_ns", "stopped_ns", "folded_tracer_tick_ns"}) {
+        const auto& histogram = stats[name];
+        std::cout << name;
+        for (const char* key: {"count", "p50", "p90", "p99", "max"}) {
+            auto iter = histogram.find(key);
+            std::cout << " " << key << "=" <<
+                (iter != histogram.end() ? iter->second : "0");
+        }
+        std::cout << "\n";
+    }
+    std::cout << boost::format(
+            "throughput baseline=%.0f profiled=%.0f slowdown_percent=%.2f\n") %
+        baseline %
+        profiled %
+        (baseline ? 100 * (1 - profiled / baseline) : 0);
+    std::cout << boost::format(
+            "wat cpu_percent=%.2f max_rss_kb=%d\n") %
+        (100 * cpuSeconds / watSeconds) %
+        usage.ru_maxrss;
+    std::cout << boost::format("attach ms=%.3f\n") % (attachSeconds * 1e3);
+    std::cout << boost::format("detach ms=%.3f detached=%d\n") %
+        (detachSeconds * 1e3) % isDetached;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        Config config;
+        int opt;
+        while ((opt = getopt(argc, argv, "w:T:s:H:a:t:d:i:l:")) != -1) {
+            switch (opt) {
+                case 'w':
+                    config.wat = optarg;
+                    break;
+                case 'T':
+                    config.target = optarg;
+                    break;
+                case 's':
+                    config.seconds = boost::lexical_cast<double>(optarg);
+                    break;
+                case 'H':
+                    config.frequency = boost::lexical_cast<int>(optarg);
+                    break;
+                case 'a':
+                    config.watArgs.push_back(optarg);
+                    break;
+                case 't':
+                case 'd':
+                case 'i':
+                case 'l':
+                    config.targetOptions.emplace_back(opt, optarg);
+                    break;
+                default:
+                    usage(argv[0]);
+                    return 1;
+            }
+        }
+        if (optind != argc || config.seconds <= 0 || config.frequency < 1) {
+            usage(argv[0]);
+            return 1;
+        }
+        run(config);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,271 @@
+#include "call_tree.h"
+
+#include <algorithm>
+
+namespace {
+
+const uint32_t ROOT = 0;
+// Compaction is not worth it for small trees.
+const size_t MIN_COMPACTED_SIZE = 4096;
+
+template <class T>
+void sortDescending(std::vector<std::pair<uint32_t, T>>* items) {
+    std::sort(items->begin(), items->end(),
+            [](const std::pair<uint32_t, T>& a,
+                    const std::pair<uint32_t, T>& b) {
+                return a.first != b.first ?
+                    a.first > b.first :
+                    a.second < b.second;
+            });
+}
+
+} // namespace
+
+CallTree::CallTree(std::chrono::steady_clock::duration window) :
+    isExpiring_(true),
+    window_(window),
+    nodes_(1, Node{0, ROOT, {0, 0}}),
+    liveNodes_(1),
+    firstTick_(0),
+    ticks_(0),
+    firstLeaf_(0),
+    leafCount_(0),
+    stamp_(0)
+{}
+
+CallTree::CallTree() :
+    isExpiring_(false),
+    window_(0),
+    nodes_(1, Node{0, ROOT, {0, 0}}),
+    liveNodes_(1),
+    firstTick_(0),
+    ticks_(0),
+    firstLeaf_(0),
+    leafCount_(0),
+    stamp_(0)
+{}
+
+void CallTree::push(const SampleBatch& batch) {
+    if (!isExpiring_) {
+        // No leaves to remember and no nodes to compact.
+        for (size_t i = 0; i != batch.size(); ++i) {
+            pushStacktrace(batch[i]);
+        }
+        ++ticks_;
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    while (ticks_ && now - tickTimes_[firstTick_] >= window_) {
+        popTick();
+    }
+    if (ticks_ == tickSizes_.size()) {
+        growTicks();
+    }
+
+    if (leafCount_ + batch.size() > leaves_.size()) {
+        // Grows until it fits the busiest window seen.
+        std::vector<uint32_t> leaves(
+                std::max(2 * leaves_.size(), leafCount_ + batch.size()));
+        for (size_t i = 0; i != leafCount_; ++i) {
+            leaves[i] = leaves_[(firstLeaf_ + i) % leaves_.size()];
+        }
+        leaves_.swap(leaves);
+        firstLeaf_ = 0;
+    }
+    for (size_t i = 0; i != batch.size(); ++i) {
+        leaves_[(firstLeaf_ + leafCount_++) % leaves_.size()] =
+            pushStacktrace(batch[i]);
+    }
+    size_t tick = (firstTick_ + ticks_++) % tickSizes_.size();
+    tickSizes_[tick] = batch.size();
+    tickTimes_[tick] = now;
+
+    if (nodes_.size() > MIN_COMPACTED_SIZE &&
+            nodes_.size() > 2 * liveNodes_) {
+        compact();
+    }
+}
+
+CallTree::Counts CallTree::counts(FunctionId function) const {
+    return function < functions_.size() ?
+        functions_[function] : Counts{0, 0};
+}
+
+const std::vector<std::pair<CallTree::Counts, FunctionId>>&
+CallTree::topFunctions(size_t count, bool bySelf) {
+    top_.clear();
+    for (FunctionId function = 0; function != functions_.size(); ++function) {
+        const auto& counts = functions_[function];
+        if (counts.total) {
+            top_.emplace_back(counts, function);
+        }
+    }
+    auto key = [=](const Counts& counts) {
+        return bySelf ?
+            std::make_pair(counts.self, counts.total) :
+            std::make_pair(counts.total, counts.self);
+    };
+    count = std::min(count, top_.size());
+    std::partial_sort(top_.begin(), top_.begin() + count, top_.end(),
+            [&](const std::pair<Counts, FunctionId>& a,
+                    const std::pair<Counts, FunctionId>& b) {
+                return key(a.first) != key(b.first) ?
+                    key(a.first) > key(b.first) :
+                    a.second < b.second;
+            });
+    top_.resize(count);
+    return top_;
+}
+
+void CallTree::neighbours(
+        FunctionId function,
+        std::vector<std::pair<uint32_t, FunctionId>>* callers,
+        std::vector<std::pair<uint32_t, FunctionId>>* callees) {
+    callers->clear();
+    callees->clear();
+
+    auto collect = [&](std::vector<std::pair<uint32_t, FunctionId>>* result) {
+        for (FunctionId f = 0; f != neighbourCounts_.size(); ++f) {
+            if (neighbourCounts_[f]) {
+                result->emplace_back(neighbourCounts_[f], f);
+                neighbourCounts_[f] = 0;
+            }
+        }
+        sortDescending(result);
+    };
+    neighbourCounts_.resize(functions_.size());
+
+    // Only the outermost calls of a recursive function are counted.
+    // Parents always precede their children.
+    isUnderFunction_.assign(nodes_.size(), false);
+    for (uint32_t node = 1; node != nodes_.size(); ++node) {
+        uint32_t parent = nodes_[node].parent;
+        isUnderFunction_[node] = isUnderFunction_[parent] ||
+            (parent != ROOT && nodes_[parent].function == function);
+        if (nodes_[node].function == function &&
+                !isUnderFunction_[node] &&
+                parent != ROOT) {
+            neighbourCounts_[nodes_[parent].function] +=
+                nodes_[node].counts.total;
+        }
+    }
+    collect(callers);
+
+    for (uint32_t node = 1; node != nodes_.size(); ++node) {
+        uint32_t parent = nodes_[node].parent;
+        if (parent != ROOT &&
+                nodes_[parent].function == function &&
+                !isUnderFunction_[parent]) {
+            neighbourCounts_[nodes_[node].function] +=
+                nodes_[node].counts.total;
+        }
+    }
+    collect(callees);
+}
+
+uint32_t CallTree::pushStacktrace(
+        const SampleBatch::Stacktrace& stacktrace) {
+    ++stamp_;
+    uint32_t node = ROOT;
+    // The outermost frame is the last one.
+    for (auto frame = stacktrace.end(); frame != stacktrace.begin(); ) {
+        --frame;
+        node = child(node, frame->function);
+        if (!nodes_[node].counts.total++) {
+            ++liveNodes_;
+        }
+        FunctionId function = frame->function;
+        if (function >= functions_.size()) {
+            functions_.resize(function + 1, Counts{0, 0});
+            stamps_.resize(function + 1, 0);
+        }
+        if (stamps_[function] != stamp_) {
+            stamps_[function] = stamp_;
+            ++functions_[function].total;
+        }
+    }
+    if (node != ROOT) {
+        ++nodes_[node].counts.self;
+        ++functions_[nodes_[node].function].self;
+    }
+    return node;
+}
+
+void CallTree::popStacktrace(uint32_t leaf) {
+    if (leaf == ROOT) {
+        return;
+    }
+    ++stamp_;
+    --nodes_[leaf].counts.self;
+    --functions_[nodes_[leaf].function].self;
+    for (uint32_t node = leaf; node != ROOT; node = nodes_[node].parent) {
+        if (!--nodes_[node].counts.total) {
+            --liveNodes_;
+        }
+        FunctionId function = nodes_[node].function;
+        if (stamps_[function] != stamp_) {
+            stamps_[function] = stamp_;
+            --functions_[function].total;
+        }
+    }
+}
+
+void CallTree::popTick() {
+    uint32_t size = tickSizes_[firstTick_];
+    for (uint32_t i = 0; i != size; ++i) {
+        popStacktrace(leaves_[(firstLeaf_ + i) % leaves_.size()]);
+    }
+    firstLeaf_ = (firstLeaf_ + size) % std::max<size_t>(1, leaves_.size());
+    leafCount_ -= size;
+    firstTick_ = (firstTick_ + 1) % tickSizes_.size();
+    --ticks_;
+}
+
+void CallTree::growTicks() {
+    // Grows until it fits the most ticks a window has seen.
+    size_t size = std::max<size_t>(16, 2 * tickSizes_.size());
+    std::vector<uint32_t> sizes(size);
+    std::vector<std::chrono::steady_clock::time_point> times(size);
+    for (size_t i = 0; i != ticks_; ++i) {
+        sizes[i] = tickSizes_[(firstTick_ + i) % tickSizes_.size()];
+        times[i] = tickTimes_[(firstTick_ + i) % tickSizes_.size()];
+    }
+    tickSizes_.swap(sizes);
+    tickTimes_.swap(times);
+    firstTick_ = 0;
+}
+
+uint32_t CallTree::child(uint32_t parent, FunctionId function) {
+    auto inserted = children_.emplace(
+            static_cast<uint64_t>(parent) << 32 | function, nodes_.size());
+    if (inserted.second) {
+        nodes_.push_back(Node{function, parent, {0, 0}});
+    }
+    return inserted.first->second;
+}
+
+void CallTree::compact() {
+    std::vector<uint32_t> ids(nodes_.size());
+    std::vector<Node> nodes(1, nodes_[ROOT]);
+    children_.clear();
+    for (uint32_t node = 1; node != nodes_.size(); ++node) {
+        if (!nodes_[node].counts.total) {
+            continue;
+        }
+        ids[node] = nodes.size();
+        Node copy = nodes_[node];
+        copy.parent = ids[copy.parent];
+        children_.emplace(
+                static_cast<uint64_t>(copy.parent) << 32 | copy.function,
+                nodes.size());
+        nodes.push_back(copy);
+    }
+    nodes_.swap(nodes);
+    liveNodes_ = nodes_.size();
+
+    for (size_t i = 0; i != leafCount_; ++i) {
+        auto& leaf = leaves_[(firstLeaf_ + i) % leaves_.size()];
+        leaf = ids[leaf];
+    }
+}
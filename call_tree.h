@@ -0,0 +1,93 @@
+#pragma once
+
+#include "frame.h"
+#include "sample_batch.h"
+
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Calling context tree of the stacktraces in the ticks pushed during the
+// last window of time, or in all of them.
+// Every node is a function called along a particular path from the
+// outermost frame, and counts the samples passing through it (total)
+// and ending in it (self). Pushing or expiring a sample costs
+// O(depth). Per-function counts are kept alongside, with a function
+// counted once per sample even when it is recursive.
+class CallTree {
+public:
+    struct Counts {
+        uint32_t self;
+        uint32_t total;
+    };
+
+    struct Node {
+        FunctionId function;
+        uint32_t parent;
+        Counts counts;
+    };
+
+    explicit CallTree(std::chrono::steady_clock::duration window);
+    // Never expires a sample, nor keeps what it would take to. For
+    // reports on a whole recording.
+    CallTree();
+
+    void push(const SampleBatch& batch);
+    // Ticks in the window, the denominator for percentages.
+    size_t ticks() const { return ticks_; }
+
+    Counts counts(FunctionId function) const;
+    // Sorted by self or total count, valid until the next call.
+    const std::vector<std::pair<Counts, FunctionId>>& topFunctions(
+            size_t count, bool bySelf);
+    // Functions calling function and called by it, with the total count
+    // of the samples going through each call, sorted by it.
+    void neighbours(
+            FunctionId function,
+            std::vector<std::pair<uint32_t, FunctionId>>* callers,
+            std::vector<std::pair<uint32_t, FunctionId>>* callees);
+
+    // Parents precede their children. Node 0 is the root, it stands
+    // for no function at all. Nodes with zero total are left over.
+    const std::vector<Node>& nodes() const { return nodes_; }
+
+private:
+    // Returns the leaf node.
+    uint32_t pushStacktrace(const SampleBatch::Stacktrace& stacktrace);
+    void popStacktrace(uint32_t leaf);
+    void popTick();
+    void growTicks();
+    uint32_t child(uint32_t parent, FunctionId function);
+    // Drops the nodes no sample passes through anymore.
+    void compact();
+
+    bool isExpiring_;
+    std::chrono::steady_clock::duration window_;
+
+    std::vector<Node> nodes_;
+    std::unordered_map<uint64_t, uint32_t> children_;
+    size_t liveNodes_;
+
+    // Rings of sample counts and push times of the ticks, oldest first.
+    std::vector<uint32_t> tickSizes_;
+    std::vector<std::chrono::steady_clock::time_point> tickTimes_;
+    size_t firstTick_;
+    size_t ticks_;
+    // Ring of leaf nodes of all the samples, oldest first.
+    std::vector<uint32_t> leaves_;
+    size_t firstLeaf_;
+    size_t leafCount_;
+
+    // Indexed by FunctionId.
+    std::vector<Counts> functions_;
+    // Last sample the function has been counted in.
+    std::vector<uint64_t> stamps_;
+    // Every push and pop takes one, 32 bits would wrap within hours.
+    uint64_t stamp_;
+
+    std::vector<std::pair<Counts, FunctionId>> top_;
+    std::vector<uint32_t> neighbourCounts_;
+    std::vector<char> isUnderFunction_;
+};
@@ -0,0 +1,183 @@
+#include "control_socket.h"
+#include "event_loop.h"
+#include "exception.h"
+#include "thread_pool.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// Longer lines are no command.
+const size_t MAX_COMMAND = 4096;
+
+std::string errorReply(const std::exception& e) {
+    return std::string("error: ") + e.what() + "\n";
+}
+
+} // namespace
+
+ControlSocket::ControlSocket(
+        const std::string& path, EventLoop* loop, Handler handler) :
+    path_(path),
+    loop_(loop),
+    handler_(std::move(handler)),
+    listener_(throwErrnoIfMinus1(socket(
+                    AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))),
+    worker_(new ThreadPool(1)),
+    repliesReady_(throwErrnoIfMinus1(
+                eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)))
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error(path + ": too long for a socket");
+    }
+    strcpy(address.sun_path, path.c_str());
+
+    // Left over by a previous run.
+    struct stat st;
+    if (!lstat(path.c_str(), &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+    throwErrnoIfMinus1(bind(listener_.get(),
+                reinterpret_cast<sockaddr*>(&address), sizeof(address)));
+    throwErrnoIfMinus1(chmod(path.c_str(), 0600));
+    throwErrnoIfMinus1(listen(listener_.get(), 16));
+    loop_->add(listener_.get(), [this] { accept(); });
+    loop_->add(repliesReady_.get(), [this] { sendReplies(); });
+}
+
+ControlSocket::~ControlSocket() {
+    // Replies still being made are dropped along with their clients.
+    worker_.reset();
+    while (!clients_.empty()) {
+        close(clients_.begin()->first);
+    }
+    loop_->remove(repliesReady_.get());
+    loop_->remove(listener_.get());
+    unlink(path_.c_str());
+}
+
+void ControlSocket::accept() {
+    for (;;) {
+        int fd = accept4(listener_.get(), nullptr, nullptr,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EAGAIN || errno == EINTR || errno == ECONNABORTED) {
+                return;
+            }
+            throwErrno();
+        }
+        clients_[fd];
+        loop_->add(fd, [=] { read(fd); });
+    }
+}
+
+void ControlSocket::read(int fd) {
+    auto& input = clients_[fd].input;
+    char buffer[512];
+    ssize_t size;
+    while ((size = ::read(fd, buffer, sizeof(buffer))) > 0) {
+        input.append(buffer, size);
+        auto end = input.find('\n');
+        if (end != std::string::npos) {
+            reply(fd, input.substr(0, end));
+            return;
+        }
+        if (input.size() > MAX_COMMAND) {
+            close(fd);
+            return;
+        }
+    }
+    if (size == 0) {
+        // No newline after the last command.
+        reply(fd, input);
+    } else if (errno != EAGAIN && errno != EINTR) {
+        close(fd);
+    }
+}
+
+void ControlSocket::reply(int fd, const std::string& command) {
+    // Nothing more is read, and until the reply is made nothing is
+    // written either.
+    loop_->remove(fd);
+    clients_[fd].isWatched = false;
+
+    Reply make;
+    try {
+        make = handler_(command);
+    } catch (const std::exception& e) {
+        clients_[fd].output = errorReply(e);
+        send(fd);
+        return;
+    }
+    worker_->post([this, fd, make] {
+        std::string text;
+        try {
+            text = make();
+        } catch (const std::exception& e) {
+            text = errorReply(e);
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            replies_.emplace_back(fd, std::move(text));
+        }
+        uint64_t one = 1;
+        throwErrnoIfMinus1(
+                write(repliesReady_.get(), &one, sizeof(one)));
+    });
+}
+
+void ControlSocket::sendReplies() {
+    uint64_t count;
+    while (::read(repliesReady_.get(), &count, sizeof(count)) > 0) {
+    }
+    std::vector<std::pair<int, std::string>> replies;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        replies.swap(replies_);
+    }
+    for (auto& reply: replies) {
+        clients_[reply.first].output = std::move(reply.second);
+        send(reply.first);
+    }
+}
+
+void ControlSocket::send(int fd) {
+    auto& client = clients_[fd];
+    while (client.sent != client.output.size()) {
+        ssize_t size = ::send(fd, client.output.data() + client.sent,
+                client.output.size() - client.sent, MSG_NOSIGNAL);
+        if (size == -1 && errno == EINTR) {
+            continue;
+        }
+        if (size == -1 && errno == EAGAIN) {
+            if (!client.isWatched) {
+                loop_->addWritable(fd, [=] { send(fd); });
+                client.isWatched = true;
+            }
+            return;
+        }
+        if (size <= 0) {
+            // A client failing to get its reply is its own business.
+            break;
+        }
+        client.sent += size;
+    }
+    close(fd);
+}
+
+void ControlSocket::close(int fd) {
+    if (clients_[fd].isWatched) {
+        loop_->remove(fd);
+    }
+    clients_.erase(fd);
+    ::close(fd);
+}
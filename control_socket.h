@@ -0,0 +1,60 @@
+#pragma once
+
+#include "file_descriptor.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class EventLoop;
+class ThreadPool;
+
+// Unix-domain stream socket taking a single command line per connection.
+// The handler runs on the loop, so it may touch what the loop owns, and
+// returns what makes the reply. That runs on a thread of the socket's
+// own, the loop goes on sampling meanwhile. The reply is then sent
+// back as the client reads it and the connection closed.
+// The socket is only accessible to the owner, and removed on
+// destruction.
+class ControlSocket {
+public:
+    // Throws from either are replied as "error: what".
+    typedef std::function<std::string ()> Reply;
+    typedef std::function<Reply (const std::string&)> Handler;
+
+    ControlSocket(const std::string& path, EventLoop* loop, Handler handler);
+    ~ControlSocket();
+
+private:
+    struct Client {
+        std::string input;
+        std::string output;
+        size_t sent = 0;
+        // Whether the loop has a handler for the fd.
+        bool isWatched = true;
+    };
+
+    void accept();
+    void read(int fd);
+    void reply(int fd, const std::string& command);
+    // On the loop, when replies are ready.
+    void sendReplies();
+    void send(int fd);
+    void close(int fd);
+
+    std::string path_;
+    EventLoop* loop_;
+    Handler handler_;
+    FileDescriptor listener_;
+    std::map<int, Client> clients_;
+
+    std::unique_ptr<ThreadPool> worker_;
+    // Counts the replies made by the worker.
+    FileDescriptor repliesReady_;
+    std::mutex mutex_;
+    std::vector<std::pair<int, std::string>> replies_;
+};
@@ -0,0 +1,139 @@
+#include "elf_symbols.h"
+#include "exception.h"
+#include "scope.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ElfSymbols::ElfSymbols(const std::string& path) {
+    int fd = throwErrnoIfMinus1(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    SCOPE_EXIT(close(fd));
+
+    struct stat st;
+    throwErrnoIfMinus1(fstat(fd, &st));
+    size_t size = st.st_size;
+    if (size < sizeof(Elf64_Ehdr)) {
+        throw std::runtime_error(path + ": not an ELF file");
+    }
+    void* image = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED) {
+        throwErrno();
+    }
+    image_ = std::unique_ptr<void, std::function<void (void*)>>(
+            image, [=](void* image) { munmap(image, size); });
+
+    const char* base = static_cast<const char *>(image);
+    auto inImage = [&](size_t offset, size_t length) {
+        return offset <= size && length <= size - offset;
+    };
+
+    const auto* ehdr = reinterpret_cast<const Elf64_Ehdr *>(base);
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+            ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+            !inImage(ehdr->e_phoff, ehdr->e_phnum * sizeof(Elf64_Phdr)) ||
+            !inImage(ehdr->e_shoff, ehdr->e_shnum * sizeof(Elf64_Shdr))) {
+        throw std::runtime_error(path + ": not a 64-bit ELF file");
+    }
+
+    const auto* phdrs = reinterpret_cast<const Elf64_Phdr *>(
+            base + ehdr->e_phoff);
+    for (size_t i = 0; i != ehdr->e_phnum; ++i) {
+        if (phdrs[i].p_type == PT_LOAD) {
+            segments_.push_back({
+                    phdrs[i].p_offset,
+                    phdrs[i].p_vaddr,
+                    phdrs[i].p_filesz});
+        }
+    }
+
+    const auto* shdrs = reinterpret_cast<const Elf64_Shdr *>(
+            base + ehdr->e_shoff);
+    for (size_t i = 0; i != ehdr->e_shnum; ++i) {
+        const auto& shdr = shdrs[i];
+        if ((shdr.sh_type != SHT_SYMTAB && shdr.sh_type != SHT_DYNSYM) ||
+                shdr.sh_link >= ehdr->e_shnum ||
+                shdr.sh_entsize != sizeof(Elf64_Sym) ||
+                !inImage(shdr.sh_offset, shdr.sh_size)) {
+            continue;
+        }
+        const auto& strtab = shdrs[shdr.sh_link];
+        if (!inImage(strtab.sh_offset, strtab.sh_size)) {
+            continue;
+        }
+        const auto* syms = reinterpret_cast<const Elf64_Sym *>(
+                base + shdr.sh_offset);
+        for (size_t j = 0; j != shdr.sh_size / sizeof(Elf64_Sym); ++j) {
+            const auto& sym = syms[j];
+            int type = ELF64_ST_TYPE(sym.st_info);
+            if ((type != STT_FUNC && type != STT_GNU_IFUNC) ||
+                    sym.st_shndx == SHN_UNDEF ||
+                    !sym.st_value ||
+                    sym.st_name >= strtab.sh_size) {
+                continue;
+            }
+            const char* name = base + strtab.sh_offset + sym.st_name;
+            if (!memchr(name, 0, strtab.sh_size - sym.st_name)) {
+                continue;
+            }
+            symbols_.push_back({sym.st_value, sym.st_size, name});
+        }
+    }
+
+    // The same function is usually listed in both .symtab and .dynsym.
+    std::sort(symbols_.begin(), symbols_.end(),
+            [](const Symbol& a, const Symbol& b) {
+                return a.start < b.start ||
+                    (a.start == b.start && a.size > b.size);
+            });
+    symbols_.erase(
+            std::unique(symbols_.begin(), symbols_.end(),
+                [](const Symbol& a, const Symbol& b) {
+                    return a.start == b.start;
+                }),
+            symbols_.end());
+}
+
+bool ElfSymbols::fileOffsetToVaddr(
+        unw_word_t offset, unw_word_t* vaddr) const {
+    for (const auto& segment: segments_) {
+        if (offset >= segment.offset &&
+                offset < segment.offset + segment.size) {
+            *vaddr = offset - segment.offset + segment.vaddr;
+            return true;
+        }
+    }
+    return false;
+}
+
+const ElfSymbols::Symbol* ElfSymbols::find(
+        unw_word_t vaddr, unw_word_t* begin, unw_word_t* end) const {
+    auto next = std::upper_bound(
+            symbols_.begin(), symbols_.end(), vaddr,
+            [](unw_word_t vaddr, const Symbol& symbol) {
+                return vaddr < symbol.start;
+            });
+    *end = next == symbols_.end() ? ~unw_word_t(0) : next->start;
+    if (next == symbols_.begin()) {
+        *begin = 0;
+        return nullptr;
+    }
+    auto iter = std::prev(next);
+    // Some hand written functions have zero size,
+    // those are assumed to span until the next symbol.
+    if (iter->size && vaddr >= iter->start + iter->size) {
+        *begin = iter->start + iter->size;
+        return nullptr;
+    }
+    *begin = iter->start;
+    if (iter->size) {
+        *end = std::min(*end, iter->start + iter->size);
+    }
+    return &*iter;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <libunwind.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Function symbols from .symtab and .dynsym of an ELF file.
+// The file stays mapped, so the names are not copied.
+class ElfSymbols {
+public:
+    struct Symbol {
+        unw_word_t start;
+        unw_word_t size;
+        const char* name;
+    };
+
+    // Throws if the file cannot be read or is not a 64-bit ELF file.
+    explicit ElfSymbols(const std::string& path);
+
+    // Translates offset in the file to the virtual address
+    // the file has been linked at. Returns false if the offset
+    // is not a part of any loadable segment.
+    bool fileOffsetToVaddr(unw_word_t offset, unw_word_t* vaddr) const;
+
+    // Returns nullptr if there is no function at vaddr. In any case
+    // [*begin, *end) is set to the range around vaddr for which
+    // the result is the same.
+    const Symbol* find(
+            unw_word_t vaddr, unw_word_t* begin, unw_word_t* end) const;
+
+private:
+    struct Segment {
+        unw_word_t offset;
+        unw_word_t vaddr;
+        unw_word_t size;
+    };
+
+    std::unique_ptr<void, std::function<void (void*)>> image_;
+    std::vector<Segment> segments_;
+    std::vector<Symbol> symbols_;
+};
@@ -0,0 +1,68 @@
+#include "event_loop.h"
+#include "exception.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+EventLoop::EventLoop() :
+    epoll_(throwErrnoIfMinus1(epoll_create1(EPOLL_CLOEXEC))),
+    stopEvent_(throwErrnoIfMinus1(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))),
+    isStopped_(false)
+{
+    add(stopEvent_.get(), [this] {
+        uint64_t count;
+        while (read(stopEvent_.get(), &count, sizeof(count)) > 0) {
+        }
+        isStopped_ = true;
+    });
+}
+
+void EventLoop::add(int fd, std::function<void ()> onReadable) {
+    add(fd, EPOLLIN, std::move(onReadable));
+}
+
+void EventLoop::addWritable(int fd, std::function<void ()> onWritable) {
+    add(fd, EPOLLOUT, std::move(onWritable));
+}
+
+void EventLoop::add(
+        int fd, uint32_t events, std::function<void ()> handler) {
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    throwErrnoIfMinus1(epoll_ctl(epoll_.get(), EPOLL_CTL_ADD, fd, &event));
+    handlers_[fd] = std::move(handler);
+}
+
+void EventLoop::remove(int fd) {
+    throwErrnoIfMinus1(epoll_ctl(epoll_.get(), EPOLL_CTL_DEL, fd, nullptr));
+    handlers_.erase(fd);
+}
+
+void EventLoop::run() {
+    isStopped_ = false;
+    while (!isStopped_) {
+        epoll_event events[16];
+        int count = epoll_wait(epoll_.get(), events, 16, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throwErrno();
+        }
+        for (int i = 0; i != count && !isStopped_; ++i) {
+            // Removed by an earlier handler.
+            auto iter = handlers_.find(events[i].data.fd);
+            if (iter != handlers_.end()) {
+                // The handler may remove itself.
+                auto handler = iter->second;
+                handler();
+            }
+        }
+    }
+}
+
+void EventLoop::stop() {
+    uint64_t one = 1;
+    throwErrnoIfMinus1(write(stopEvent_.get(), &one, sizeof(one)));
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "file_descriptor.h"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+
+// Runs handlers of readable or writable file descriptors, multiplexed
+// with epoll.
+// Everything but stop() is to be called from the thread running it.
+class EventLoop {
+public:
+    EventLoop();
+
+    // Level-triggered, the handler has to drain fd.
+    void add(int fd, std::function<void ()> onReadable);
+    // Level-triggered too, the handler has to write until it would
+    // block or remove fd.
+    void addWritable(int fd, std::function<void ()> onWritable);
+    void remove(int fd);
+
+    // Returns after stop().
+    void run();
+    // May be called from any thread, or from a handler.
+    void stop();
+
+private:
+    void add(int fd, uint32_t events, std::function<void ()> handler);
+
+    FileDescriptor epoll_;
+    FileDescriptor stopEvent_;
+    std::map<int, std::function<void ()>> handlers_;
+    bool isStopped_;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <unistd.h>
+
+class FileDescriptor {
+public:
+    explicit FileDescriptor(int fd = -1): fd_(fd) {}
+    ~FileDescriptor() { reset(); }
+
+    FileDescriptor(FileDescriptor&& other): fd_(other.release()) {}
+    FileDescriptor& operator=(FileDescriptor&& other) {
+        reset(other.release());
+        return *this;
+    }
+
+    int get() const { return fd_; }
+
+    int release() {
+        int fd = fd_;
+        fd_ = -1;
+        return fd;
+    }
+
+    void reset(int fd = -1) {
+        if (fd_ != -1) {
+            close(fd_);
+        }
+        fd_ = fd;
+    }
+
+private:
+    int fd_;
+};
@@ -0,0 +1,25 @@
+#include "file_limit.h"
+#include "exception.h"
+
+#include <boost/filesystem.hpp>
+
+#include <sys/resource.h>
+
+size_t raiseFileLimit() {
+    rlimit limit;
+    throwErrnoIfMinus1(getrlimit(RLIMIT_NOFILE, &limit));
+    if (limit.rlim_cur != limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        throwErrnoIfMinus1(setrlimit(RLIMIT_NOFILE, &limit));
+    }
+    return limit.rlim_cur;
+}
+
+size_t openFiles() {
+    size_t count = 0;
+    for (boost::filesystem::directory_iterator i("/proc/self/fd"), i_end;
+            i != i_end; ++i) {
+        ++count;
+    }
+    return count;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+
+// Raises the soft limit on open files up to the hard one and returns
+// it. Tracing takes a few files per thread, the default soft limit of
+// 1024 is soon reached with large targets.
+size_t raiseFileLimit();
+
+// Files open in this process right now.
+size_t openFiles();
@@ -0,0 +1,84 @@
+#include "folded_tracer.h"
+#include "exception.h"
+#include "symbolizer.h"
+
+#include <algorithm>
+
+namespace {
+
+// By time rather than ticks, the sampling rate may vary.
+const std::chrono::seconds FLUSH_INTERVAL(10);
+
+int closeFile(FILE* file) {
+    return file == stdout ? fflush(file) : fclose(file);
+}
+
+} // namespace
+
+FoldedTracer::FoldedTracer(
+        const std::string& path, Symbolizer* symbolizer) :
+    symbolizer_(symbolizer),
+    file_(path == "-" ? stdout : fopen(path.c_str(), "w"), &closeFile),
+    lastFlush_(std::chrono::steady_clock::now())
+{
+    if (!file_) {
+        throwErrno();
+    }
+}
+
+FoldedTracer::~FoldedTracer() {
+    flush();
+}
+
+void FoldedTracer::tick(const SampleBatch& batch) {
+    for (size_t i = 0; i != batch.size(); ++i) {
+        const auto& stacktrace = batch[i];
+        if (!stacktrace.size()) {
+            continue;
+        }
+        stack_.clear();
+        for (auto frame = stacktrace.end(); frame != stacktrace.begin(); ) {
+            stack_.push_back((--frame)->function);
+        }
+        auto iter = counts_.find(stack_);
+        if (iter == counts_.end()) {
+            counts_.emplace(stack_, 1);
+        } else {
+            ++iter->second;
+        }
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastFlush_ >= FLUSH_INTERVAL) {
+        lastFlush_ = now;
+        flush();
+    }
+}
+
+void FoldedTracer::flush() {
+    for (const auto& kv: counts_) {
+        line_.clear();
+        for (FunctionId function: kv.first) {
+            if (!line_.empty()) {
+                line_.push_back(';');
+            }
+            // Semicolons separate frames.
+            size_t begin = line_.size();
+            line_ += symbolizer_->name(function);
+            std::replace(line_.begin() + begin, line_.end(), ';', ':');
+        }
+        fprintf(file_.get(), "%s %llu\n", line_.c_str(),
+                static_cast<unsigned long long>(kv.second));
+    }
+    counts_.clear();
+    fflush(file_.get());
+}
+
+size_t FoldedTracer::StackHash::operator()(
+        const std::vector<FunctionId>& stack) const {
+    // FNV-1a over the ids.
+    uint64_t hash = 14695981039346656037ull;
+    for (FunctionId function: stack) {
+        hash = (hash ^ function) * 1099511628211ull;
+    }
+    return hash;
+}
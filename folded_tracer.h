@@ -0,0 +1,42 @@
+#pragma once
+
+#include "tracer.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Symbolizer;
+
+// Writes collapsed stacks ("outer;inner;leaf count"), as consumed by
+// flamegraph.pl, to a file or a pipe. Identical stacks are counted in
+// memory and flushed every few seconds and on destruction. Stacks may
+// repeat across flushes, which flame graph tools sum up.
+class FoldedTracer : public Tracer {
+public:
+    // "-" stands for stdout.
+    FoldedTracer(const std::string& path, Symbolizer* symbolizer);
+    ~FoldedTracer();
+
+    void tick(const SampleBatch& batch) override;
+    void addInfoLine(const std::string& /* info */) override {}
+
+    void flush();
+
+private:
+    struct StackHash {
+        size_t operator()(const std::vector<FunctionId>& stack) const;
+    };
+
+    Symbolizer* symbolizer_;
+    std::unique_ptr<FILE, int (*)(FILE*)> file_;
+    std::chrono::steady_clock::time_point lastFlush_;
+    // Outermost function first.
+    std::unordered_map<std::vector<FunctionId>, uint64_t, StackHash> counts_;
+    std::vector<FunctionId> stack_;
+    std::string line_;
+};
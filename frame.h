@@ -2,12 +2,16 @@
 
 #include <libunwind.h>
 
-#include <string>
+#include <cstdint>
+
+// Dense id of a function, assigned by Symbolizer.
+typedef uint32_t FunctionId;
 
 struct Frame {
     unw_word_t ip;
     unw_word_t sp;
-    std::string procName;
+    // Filled in after unwinding.
+    FunctionId function = 0;
 
     bool operator <(const Frame& other) const {
         return ip < other.ip;
@@ -0,0 +1,36 @@
+#include "frame_pointer_unwinder.h"
+#include "snapshot.h"
+
+FramePointerUnwinder::FramePointerUnwinder(UnwindStats* stats) :
+    Unwinder(stats)
+{}
+
+std::vector<Frame> FramePointerUnwinder::unwindImpl(
+        const StackSnapshot& snapshot) {
+    std::vector<Frame> stacktrace;
+
+    SnapshotUnwindInfo memory(snapshot, nullptr);
+    unw_word_t ip = snapshot.regs.rip;
+    unw_word_t sp = snapshot.regs.rsp;
+    unw_word_t bp = snapshot.regs.rbp;
+    for (;;) {
+        stacktrace.push_back({ip, sp});
+        if (stacktrace.size() == MAX_DEPTH) {
+            break;
+        }
+
+        // The stack grows down, so every next frame must be above
+        // the current one. Anything else means the chain is broken.
+        unw_word_t nextBp;
+        if (bp < sp || bp % sizeof(bp) ||
+                !memory.readWord(bp, &nextBp) ||
+                !memory.readWord(bp + sizeof(bp), &ip) ||
+                !ip) {
+            break;
+        }
+        sp = bp + 2*sizeof(bp);
+        bp = nextBp;
+    }
+
+    return stacktrace;
+}
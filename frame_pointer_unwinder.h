@@ -0,0 +1,14 @@
+#pragma once
+
+#include "unwinder.h"
+
+// Follows the chain of saved rbp values. Only works for code compiled
+// with -fno-omit-frame-pointer, but does not need any unwind tables.
+// The chain is mostly read from the stack copy in the snapshot.
+class FramePointerUnwinder : public Unwinder {
+public:
+    explicit FramePointerUnwinder(UnwindStats* stats);
+
+private:
+    std::vector<Frame> unwindImpl(const StackSnapshot& snapshot) override;
+};
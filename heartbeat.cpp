@@ -1,49 +1,36 @@
-#include "exception.h"
 #include "heartbeat.h"
+#include "exception.h"
 
-#include <stdexcept>
-
-#include <sys/time.h>
-
-namespace {
-
-uint64_t now() {
-    struct timeval tv;
-    throwErrnoIfMinus1(gettimeofday(&tv, nullptr));
-    return tv.tv_usec +
-        static_cast<uint64_t>(tv.tv_sec)*1000000;
-}
+#include <cstdint>
 
-}
+#include <sys/timerfd.h>
 
 Heartbeat::Heartbeat(int freq) :
-    interval_(1000000 / freq),
-    nextExpectedBeat_(now()),
+    timer_(throwErrnoIfMinus1(timerfd_create(
+                    CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))),
     skipped_(0)
 {
+    setFrequency(freq);
 }
 
-void Heartbeat::beat() {
-    uint64_t t = now();
-    if (t < nextExpectedBeat_) {
-        throw std::logic_error("Too soon");
-    }
-    uint64_t elapsed = t - nextExpectedBeat_;
-    skipped_ = elapsed / interval_;
-    if (skipped_ > 0) {
-        --skipped_;
-    }
-    nextExpectedBeat_ += (skipped_ + 1)*interval_;
-    if (nextExpectedBeat_ < t) {
-        nextExpectedBeat_ += interval_;
-    }
+void Heartbeat::setFrequency(int freq) {
+    frequency_ = freq;
+    uint64_t interval = 1000000000 / freq;
+    itimerspec timer{};
+    timer.it_interval.tv_sec = interval / 1000000000;
+    timer.it_interval.tv_nsec = interval % 1000000000;
+    timer.it_value = timer.it_interval;
+    throwErrnoIfMinus1(timerfd_settime(timer_.get(), 0, &timer, nullptr));
 }
 
-uint64_t Heartbeat::usecondsUntilNextBeat() {
-    uint64_t t = now();
-    if (t > nextExpectedBeat_) {
-        return 0;
-    } else {
-        return nextExpectedBeat_ - t;
+bool Heartbeat::beat() {
+    uint64_t expirations;
+    if (read(timer_.get(), &expirations, sizeof(expirations)) < 0) {
+        if (errno == EAGAIN) {
+            return false;
+        }
+        throwErrno();
     }
+    skipped_ = expirations - 1;
+    return true;
 }
@@ -1,16 +1,26 @@
 #pragma once
 
-#include <cstdint>
+#include "file_descriptor.h"
 
+// Periodic beats on CLOCK_MONOTONIC, delivered through a timerfd.
 class Heartbeat {
 public:
     explicit Heartbeat(int freq);
+
+    // Readable when a beat is due.
+    int fd() const { return timer_.get(); }
+
+    int frequency() const { return frequency_; }
+    // Restarts the beats at the new frequency.
+    void setFrequency(int freq);
+
+    // Consumes the beats due. Returns false if there are none.
+    bool beat();
+    // Beats missed before the last one.
     int skippedBeats() const { return skipped_; }
-    void beat();
-    uint64_t usecondsUntilNextBeat();
 
 private:
-    uint64_t interval_;
-    uint64_t nextExpectedBeat_;
+    FileDescriptor timer_;
+    int frequency_;
     int skipped_;
 };
@@ -0,0 +1,91 @@
+#include "histogram.h"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+std::string formatNanoseconds(uint64_t nanoseconds) {
+    if (nanoseconds < 1000) {
+        return str(boost::format("%d ns") % nanoseconds);
+    } else if (nanoseconds < 1000000) {
+        return str(boost::format("%.1f us") % (nanoseconds / 1e3));
+    } else {
+        return str(boost::format("%.1f ms") % (nanoseconds / 1e6));
+    }
+}
+
+} // namespace
+
+const int Histogram::SUB_BUCKET_BITS;
+const size_t Histogram::BUCKETS;
+
+Histogram::Histogram() :
+    count_(0),
+    sum_(0),
+    max_(0)
+{
+    for (auto& count: counts_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::record(uint64_t value) {
+    counts_[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(
+                max, value, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t Histogram::quantile(double q) const {
+    uint64_t count = count_.load(std::memory_order_relaxed);
+    if (!count) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, std::ceil(q * count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i != BUCKETS; ++i) {
+        seen += counts_[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(bucketLast(i), max());
+        }
+    }
+    return max();
+}
+
+size_t Histogram::bucket(uint64_t value) {
+    const uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    if (value < SUB_BUCKETS) {
+        return value;
+    }
+    // Values in [2^exponent, 2^(exponent + 1)) share the exponent,
+    // the next bits pick the sub-bucket.
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - SUB_BUCKET_BITS;
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS +
+        ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t Histogram::bucketLast(size_t bucket) {
+    const uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / SUB_BUCKETS - 1;
+    uint64_t first = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return first + ((uint64_t(1) << shift) - 1);
+}
+
+std::string formatDurations(const Histogram& histogram) {
+    return str(boost::format("p50 %s, p90 %s, p99 %s, max %s, %d samples") %
+            formatNanoseconds(histogram.quantile(0.5)) %
+            formatNanoseconds(histogram.quantile(0.9)) %
+            formatNanoseconds(histogram.quantile(0.99)) %
+            formatNanoseconds(histogram.max()) %
+            histogram.count());
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Distribution of values, recorded from any number of threads without
+// locks. Buckets are log-linear: every power of two is split into eight
+// equal sub-buckets, so quantiles are off by at most 12.5%.
+class Histogram {
+public:
+    Histogram();
+
+    void record(uint64_t value);
+
+    uint64_t count() const { return count_; }
+    uint64_t sum() const { return sum_; }
+    uint64_t max() const { return max_; }
+    // Upper bound of the bucket holding the q-th quantile, 0 <= q <= 1.
+    // Racy against record(), which is fine for reporting.
+    uint64_t quantile(double q) const;
+
+private:
+    static const int SUB_BUCKET_BITS = 3;
+    static const size_t BUCKETS =
+        (64 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+    static size_t bucket(uint64_t value);
+    static uint64_t bucketLast(size_t bucket);
+
+    std::atomic<uint64_t> counts_[BUCKETS];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+// "p50 1.2 us, p90 ..., max ..., n samples" of a histogram of nanoseconds.
+std::string formatDurations(const Histogram& histogram);
@@ -0,0 +1,35 @@
+#include "libunwind_unwinder.h"
+#include "exception.h"
+#include "snapshot.h"
+
+LibunwindUnwinder::LibunwindUnwinder(
+        unw_addr_space_t addressSpace, void* upt, UnwindStats* stats) :
+    Unwinder(stats),
+    addressSpace_(addressSpace),
+    upt_(upt)
+{}
+
+std::vector<Frame> LibunwindUnwinder::unwindImpl(
+        const StackSnapshot& snapshot) {
+    std::vector<Frame> stacktrace;
+
+    SnapshotUnwindInfo unwindInfo(snapshot, upt_);
+    unw_cursor_t cursor;
+    throwUnwindIfLessThan0(unw_init_remote(
+                &cursor, addressSpace_, &unwindInfo));
+    do {
+        unw_word_t ip;
+        unw_word_t sp;
+
+        throwUnwindIfLessThan0(unw_get_reg(&cursor, UNW_REG_IP, &ip));
+        throwUnwindIfLessThan0(unw_get_reg(&cursor, UNW_REG_SP, &sp));
+
+        stacktrace.push_back({ip, sp});
+
+        if (stacktrace.size() == MAX_DEPTH) {
+            break;
+        }
+    } while (unw_step(&cursor) > 0);
+
+    return stacktrace;
+}
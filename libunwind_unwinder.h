@@ -0,0 +1,18 @@
+#pragma once
+
+#include "unwinder.h"
+
+#include <libunwind.h>
+
+// DWARF-based unwinding with libunwind.
+class LibunwindUnwinder : public Unwinder {
+public:
+    LibunwindUnwinder(
+            unw_addr_space_t addressSpace, void* upt, UnwindStats* stats);
+
+private:
+    std::vector<Frame> unwindImpl(const StackSnapshot& snapshot) override;
+
+    unw_addr_space_t addressSpace_;
+    void* upt_;
+};
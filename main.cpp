@@ -1,32 +1,355 @@
+#include "async_tracer.h"
+#include "control_socket.h"
+#include "folded_tracer.h"
 #include "heartbeat.h"
 #include "oneshot_tracer.h"
+#include "pprof_tracer.h"
 #include "profiling_tracer.h"
 #include "profiler.h"
+#include "recording_tracer.h"
+#include "report.h"
+#include "snapshot_tracer.h"
+#include "symbolizer.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
-int main(int argc, const char *argv[])
+#include <getopt.h>
+#include <unistd.h>
+
+namespace {
+
+const int DEFAULT_FREQUENCY = 200;
+// How many beats a tracer may fall behind before losing ticks. A beat
+// hands over a batch per sampling period, which is several of them with
+// perf events. Every slot ends up holding a copy of a batch.
+const size_t QUEUED_BEATS = 64;
+const size_t DEFAULT_TOP_SIZE = 30;
+const int DEFAULT_WINDOW_SECONDS = 60;
+const int DEFAULT_SNAPSHOT_FILES = 10;
+
+void usage(const char* argv0) {
+    std::cerr << boost::format(
+            "Usage: %s [-1] [-s] [-k stack_kb] [-u libunwind|fp] "
+                "[-t] [-b percent] [-p hz [-d]]\n"
+            "           [-f file] [-r file] [-o prefix] [-S file] [-n] [-F]\n"
+            "           [-i tid|regex]... [-x tid|regex]... [-H hz]\n"
+            "           [-D prefix [-e top|folded|json] [-w seconds] "
+                "[-R files]]\n"
+            "           [-c socket] pid...\n"
+            "       %s report [-n count] [-m percent] file\n"
+            "  -1  print stacktraces once and exit\n"
+            "  -s  resume threads right after copying their stacks,\n"
+            "      unwind the copies in background\n"
+            "  -k  copy that many kilobytes of each stack (default: %d)\n"
+            "  -u  unwind with libunwind (default) or by frame pointers\n"
+            "      falling back to libunwind\n"
+            "  -t  stop threads one at a time, spread over the sampling\n"
+            "      interval with jitter, instead of all at once\n"
+            "  -b  lower the sampling rate so that threads are not stopped\n"
+            "      for more than that percentage of their time\n"
+            "  -p  sample threads running on a CPU that many times a second\n"
+            "      with perf events instead of stopping them, if permitted\n"
+            "  -d  with -p, copy stacks and unwind them with -u method\n"
+            "      instead of following frame pointers in the kernel\n"
+            "  -f  write collapsed stacks for flame graphs to file,\n"
+            "      - for stdout\n"
+            "  -r  record samples to file for `report`\n"
+            "  -o  write a gzipped pprof profile of every minute\n"
+            "      to prefix.N.pb.gz\n"
+            "  -S  write what wat itself has cost to file on exit\n"
+            "  -n  with -f, -r, -o, -D or -c, don't show the live top,\n"
+            "      implied without a terminal, which then needs one\n"
+            "      of them unless -1\n"
+            "  -F  follow forks: also profile the children of the pids,\n"
+            "      present and future, and their children\n"
+            "  -i  sample only the threads with that tid or a name\n"
+            "      matching the extended regex, may be repeated\n"
+            "  -x  never stop nor sample threads with that tid or a name\n"
+            "      matching the extended regex, may be repeated; threads\n"
+            "      excluded by name are still traced for the threads they\n"
+            "      create, by tid not at all, missing those\n"
+            "  -H  take that many samples a second if wat keeps up\n"
+            "      (default: %d)\n"
+            "  -D  every -w seconds, write the samples of the last -w\n"
+            "      seconds to prefix.N.txt (.folded, .json), N going\n"
+            "      round from 0 to -R files - 1\n"
+            "  -e  format of -D files (default: top)\n"
+            "  -w  window of -D files and -c queries (default: %d)\n"
+            "  -R  number of -D files kept (default: %d)\n"
+            "  -c  take one command per connection on a Unix socket:\n"
+            "      top [count], json [count] or folded for the samples\n"
+            "      of the last -w seconds, rate hz to change -H,\n"
+            "      dump to write the next -D file now\n") %
+        boost::filesystem::basename(argv0) %
+        boost::filesystem::basename(argv0) %
+        (ProfilerOptions().stackSnapshotSize / 1024) %
+        DEFAULT_FREQUENCY %
+        DEFAULT_WINDOW_SECONDS %
+        DEFAULT_SNAPSHOT_FILES;
+}
+
+// Commands of the control socket, see usage(). Run on the loop, the
+// snapshots are formatted by the reply.
+ControlSocket::Reply controlCommand(
+        const std::string& line,
+        Profiler* profiler,
+        SnapshotTracer* snapshots) {
+    std::istringstream in(line);
+    std::string command;
+    in >> command;
+    if (command == "top" || command == "json") {
+        size_t count;
+        if (!(in >> count)) {
+            count = DEFAULT_TOP_SIZE;
+        }
+        auto format = command == "top" ?
+            SnapshotFormat::TOP : SnapshotFormat::JSON;
+        return [=] { return snapshots->snapshot(format, count); };
+    }
+    if (command == "folded") {
+        return [=] {
+            return snapshots->snapshot(SnapshotFormat::FOLDED, 0);
+        };
+    }
+    if (command == "rate") {
+        int frequency = 0;
+        if (!(in >> frequency) || frequency < 1) {
+            throw std::runtime_error("rate takes a frequency in Hz");
+        }
+        profiler->setFrequency(frequency);
+        auto text = str(boost::format("rate %d Hz\n") % frequency);
+        return [=] { return text; };
+    }
+    if (command == "dump") {
+        return [=] { return snapshots->dump() + "\n"; };
+    }
+    throw std::runtime_error(
+            "commands: top [count], json [count], folded, rate hz, dump");
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
 {
     try {
-        if (argc != 2 && argc != 3) {
-            std::cerr << boost::format("Usage: %s pid {-1}\n") %
-                boost::filesystem::basename(argv[0]);
+        if (argc > 1 && argv[1] == std::string("report")) {
+            return report(argc - 1, argv + 1);
+        }
+        ProfilerOptions options;
+        bool oneshot = false;
+        std::string foldedPath;
+        std::string recordingPath;
+        std::string pprofPrefix;
+        std::string statsPath;
+        std::string snapshotPrefix;
+        SnapshotFormat snapshotFormat = SnapshotFormat::TOP;
+        int windowSeconds = DEFAULT_WINDOW_SECONDS;
+        int snapshotFiles = DEFAULT_SNAPSHOT_FILES;
+        std::string socketPath;
+        bool headless = false;
+        int frequency = DEFAULT_FREQUENCY;
+        int opt;
+        const char* optstring = "1sk:u:tb:p:df:r:o:S:nFi:x:H:D:e:w:R:c:";
+        while ((opt = getopt(argc, argv, optstring)) != -1) {
+            switch (opt) {
+                case '1':
+                    oneshot = true;
+                    break;
+                case 's':
+                    options.unwindAfterResume = true;
+                    break;
+                case 'k':
+                    options.stackSnapshotSize =
+                        boost::lexical_cast<size_t>(optarg) * 1024;
+                    break;
+                case 'u':
+                    if (optarg == std::string("libunwind")) {
+                        options.unwindMethod = UnwindMethod::LIBUNWIND;
+                    } else if (optarg == std::string("fp")) {
+                        options.unwindMethod = UnwindMethod::FRAME_POINTER;
+                    } else {
+                        usage(argv[0]);
+                        return 1;
+                    }
+                    break;
+                case 't':
+                    options.staggerStops = true;
+                    break;
+                case 'b':
+                    options.overheadBudget =
+                        boost::lexical_cast<double>(optarg) / 100;
+                    if (options.overheadBudget <= 0 ||
+                            options.overheadBudget > 1) {
+                        usage(argv[0]);
+                        return 1;
+                    }
+                    break;
+                case 'p':
+                    options.perfFrequency =
+                        boost::lexical_cast<int>(optarg);
+                    if (options.perfFrequency < 10) {
+                        usage(argv[0]);
+                        return 1;
+                    }
+                    break;
+                case 'd':
+                    options.perfStackDumps = true;
+                    break;
+                case 'f':
+                    foldedPath = optarg;
+                    break;
+                case 'r':
+                    recordingPath = optarg;
+                    break;
+                case 'o':
+                    pprofPrefix = optarg;
+                    break;
+                case 'S':
+                    statsPath = optarg;
+                    break;
+                case 'n':
+                    headless = true;
+                    break;
+                case 'F':
+                    options.followForks = true;
+                    break;
+                case 'H':
+                    frequency = boost::lexical_cast<int>(optarg);
+                    if (frequency < 1) {
+                        usage(argv[0]);
+                        return 1;
+                    }
+                    break;
+                case 'D':
+                    snapshotPrefix = optarg;
+                    break;
+                case 'e':
+                    if (optarg == std::string("top")) {
+                        snapshotFormat = SnapshotFormat::TOP;
+                    } else if (optarg == std::string("folded")) {
+                        snapshotFormat = SnapshotFormat::FOLDED;
+                    } else if (optarg == std::string("json")) {
+                        snapshotFormat = SnapshotFormat::JSON;
+                    } else {
+                        usage(argv[0]);
+                        return 1;
+                    }
+                    break;
+                case 'w':
+                    windowSeconds = boost::lexical_cast<int>(optarg);
+                    if (windowSeconds < 1) {
+                        usage(argv[0]);
+                        return 1;
+                    }
+                    break;
+                case 'R':
+                    snapshotFiles = boost::lexical_cast<int>(optarg);
+                    if (snapshotFiles < 1) {
+                        usage(argv[0]);
+                        return 1;
+                    }
+                    break;
+                case 'c':
+                    socketPath = optarg;
+                    break;
+                case 'i':
+                    options.threadFilter.include(optarg);
+                    break;
+                case 'x':
+                    options.threadFilter.exclude(optarg);
+                    break;
+                default:
+                    usage(argv[0]);
+                    return 1;
+            }
+        }
+        // Without a terminal there is nowhere to draw the top.
+        headless = headless || !isatty(STDOUT_FILENO);
+        if (optind == argc || (headless && !oneshot && foldedPath.empty() &&
+                    recordingPath.empty() && pprofPrefix.empty() &&
+                    snapshotPrefix.empty() && socketPath.empty())) {
+            usage(argv[0]);
             return 1;
         }
-        int pid = boost::lexical_cast<int>(argv[1]);
-        if (argc == 3 && argv[2] == std::string("-1")) {
-            OneshotTracer tracer;
-            Profiler(pid).eventLoop(&tracer, nullptr);
+        std::vector<pid_t> pids;
+        for (int i = optind; i != argc; ++i) {
+            pids.push_back(boost::lexical_cast<pid_t>(argv[i]));
+        }
+        Symbolizer symbolizer;
+        if (oneshot) {
+            // Every thread is needed at once, running or not.
+            options.perfFrequency = 0;
+            OneshotTracer tracer(&symbolizer);
+            Profiler(pids, options, &symbolizer).eventLoop({&tracer}, nullptr);
         } else {
-            const int SAMPLING = 200;
-            ProfilingTracer tracer(SAMPLING);
-            Heartbeat heartbeat(SAMPLING);
-            Profiler(pid).eventLoop(&tracer, &heartbeat);
+            Profiler profiler(pids, options, &symbolizer);
+            int sampling = profiler.samplingFrequency(frequency);
+            // By the names their costs are reported under.
+            std::vector<std::pair<std::string, std::unique_ptr<Tracer>>>
+                tracers;
+            if (!headless) {
+                tracers.emplace_back("top",
+                        new ProfilingTracer(&symbolizer));
+            }
+            if (!foldedPath.empty()) {
+                tracers.emplace_back("folded",
+                        new FoldedTracer(foldedPath, &symbolizer));
+            }
+            if (!recordingPath.empty()) {
+                tracers.emplace_back("recording", new RecordingTracer(
+                            recordingPath, sampling, &symbolizer));
+            }
+            if (!pprofPrefix.empty()) {
+                tracers.emplace_back("pprof", new PprofTracer(
+                            pprofPrefix, sampling, &symbolizer));
+            }
+            SnapshotTracer* snapshots = nullptr;
+            if (!snapshotPrefix.empty() || !socketPath.empty()) {
+                snapshots = new SnapshotTracer(snapshotPrefix, snapshotFormat,
+                        windowSeconds, snapshotFiles, &symbolizer);
+                tracers.emplace_back("snapshot", snapshots);
+            }
+            // The heartbeat frequency only changes without perf events,
+            // and then there is a period per beat whatever it is.
+            size_t periodsPerBeat = (sampling + frequency - 1) / frequency;
+            std::vector<Tracer*> tracerPointers;
+            for (auto& tracer: tracers) {
+                auto* async = new AsyncTracer(std::move(tracer.second),
+                        QUEUED_BEATS * periodsPerBeat);
+                tracer.second.reset(async);
+                profiler.addTracerCost(tracer.first, &async->tickDurations());
+                tracerPointers.push_back(async);
+            }
+            std::unique_ptr<ControlSocket> control;
+            if (!socketPath.empty()) {
+                control.reset(new ControlSocket(
+                        socketPath, profiler.loop(),
+                        [&](const std::string& line) {
+                            return controlCommand(
+                                    line, &profiler, snapshots);
+                        }));
+            }
+            Heartbeat heartbeat(frequency);
+            profiler.eventLoop(tracerPointers, &heartbeat);
+            if (!statsPath.empty()) {
+                std::ofstream stats(statsPath);
+                profiler.writeStats(stats);
+                stats.close();
+                if (!stats) {
+                    throw std::runtime_error("Failed to write " + statsPath);
+                }
+            }
         }
     } catch (const std::exception& e) {
         std::cerr << "Exception: " << e.what() << std::endl;
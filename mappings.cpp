@@ -0,0 +1,63 @@
+#include "mappings.h"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+bool operator ==(const Mapping& a, const Mapping& b) {
+    return a.start == b.start &&
+        a.end == b.end &&
+        a.offset == b.offset &&
+        a.dev == b.dev &&
+        a.inode == b.inode &&
+        a.path == b.path;
+}
+
+bool operator !=(const Mapping& a, const Mapping& b) {
+    return !(a == b);
+}
+
+std::vector<Mapping> readExecutableMappings(pid_t pid) {
+    std::vector<Mapping> mappings;
+
+    std::ifstream maps(str(boost::format("/proc/%d/maps") % pid));
+    std::string line;
+    while (std::getline(maps, line)) {
+        // start-end perms offset dev inode path
+        std::istringstream fields(line);
+        Mapping mapping;
+        char dash;
+        std::string perms;
+        fields >> std::hex >> mapping.start >> dash >> mapping.end >>
+            perms >> mapping.offset >> mapping.dev >> std::dec >>
+            mapping.inode;
+        if (!fields || perms.find('x') == std::string::npos) {
+            continue;
+        }
+        // The path may contain spaces.
+        std::getline(fields >> std::ws, mapping.path);
+        mappings.push_back(std::move(mapping));
+    }
+
+    std::sort(mappings.begin(), mappings.end(),
+            [](const Mapping& a, const Mapping& b) {
+                return a.start < b.start;
+            });
+    return mappings;
+}
+
+const Mapping* findMapping(
+        const std::vector<Mapping>& mappings, unw_word_t addr) {
+    auto iter = std::upper_bound(
+            mappings.begin(), mappings.end(), addr,
+            [](unw_word_t addr, const Mapping& mapping) {
+                return addr < mapping.start;
+            });
+    if (iter == mappings.begin()) {
+        return nullptr;
+    }
+    --iter;
+    return addr < iter->end ? &*iter : nullptr;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <libunwind.h>
+
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Executable mapping of the target process, as seen in /proc/pid/maps.
+struct Mapping {
+    unw_word_t start;
+    unw_word_t end;
+    unw_word_t offset;
+    // Device (major:minor) and inode of the file, which tell apart
+    // different files found at the same path.
+    std::string dev;
+    unsigned long inode;
+    std::string path;
+};
+
+bool operator ==(const Mapping& a, const Mapping& b);
+bool operator !=(const Mapping& a, const Mapping& b);
+
+// Sorted by start address.
+std::vector<Mapping> readExecutableMappings(pid_t pid);
+
+// Returns nullptr if addr is not mapped.
+const Mapping* findMapping(
+        const std::vector<Mapping>& mappings, unw_word_t addr);
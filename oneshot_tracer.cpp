@@ -1,17 +1,22 @@
 #include "oneshot_tracer.h"
-#include "symbols.h"
+#include "symbolizer.h"
 
 #include <boost/format.hpp>
 
 #include <iostream>
 
-void OneshotTracer::tick(std::map<pid_t, std::vector<Frame>> stacktraces) {
-    for (const auto& kv: stacktraces) {
-        std::cout << boost::format("Thread %d:\n") % kv.first;
-        for (const auto& frame: kv.second) {
+OneshotTracer::OneshotTracer(Symbolizer* symbolizer) :
+    symbolizer_(symbolizer)
+{}
+
+void OneshotTracer::tick(const SampleBatch& batch) {
+    for (size_t i = 0; i != batch.size(); ++i) {
+        std::cout << boost::format("Thread %d of pid %d:\n") %
+            batch[i].tid() % batch[i].pid();
+        for (const auto& frame: batch[i]) {
             std::cout << str(boost::format("0x%x %s\n") %
                         frame.ip %
-                        abbrev(demangle(frame.procName)));
+                        symbolizer_->name(frame.function));
         }
         std::cout << std::endl;
     }
@@ -2,8 +2,14 @@
 
 #include "tracer.h"
 
+class Symbolizer;
+
 class OneshotTracer : public Tracer {
 public:
-    void tick(std::map<pid_t, std::vector<Frame>> stacktraces) override;
+    explicit OneshotTracer(Symbolizer* symbolizer);
+    void tick(const SampleBatch& batch) override;
     void addInfoLine(const std::string& info) override;
+
+private:
+    Symbolizer* symbolizer_;
 };
@@ -0,0 +1,357 @@
+#include "perf_sampler.h"
+#include "exception.h"
+#include "file_limit.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include "symbolizer.h"
+#include "task_list.h"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+
+#include <libunwind-ptrace.h>
+
+#include <asm/perf_regs.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace {
+
+// Dumps larger than that are refused by the kernel.
+const size_t MAX_STACK_DUMP = 65528;
+// Left for symbol files, outputs and the like once the events are open.
+const size_t SPARE_FILES = 256;
+
+// User registers in the order of their bits in sample_regs_user,
+// which is the order they are dumped in.
+const struct {
+    int perfReg;
+    size_t offset;
+} USER_REGS[] = {
+    {PERF_REG_X86_AX, offsetof(user_regs_struct, rax)},
+    {PERF_REG_X86_BX, offsetof(user_regs_struct, rbx)},
+    {PERF_REG_X86_CX, offsetof(user_regs_struct, rcx)},
+    {PERF_REG_X86_DX, offsetof(user_regs_struct, rdx)},
+    {PERF_REG_X86_SI, offsetof(user_regs_struct, rsi)},
+    {PERF_REG_X86_DI, offsetof(user_regs_struct, rdi)},
+    {PERF_REG_X86_BP, offsetof(user_regs_struct, rbp)},
+    {PERF_REG_X86_SP, offsetof(user_regs_struct, rsp)},
+    {PERF_REG_X86_IP, offsetof(user_regs_struct, rip)},
+    {PERF_REG_X86_R8, offsetof(user_regs_struct, r8)},
+    {PERF_REG_X86_R9, offsetof(user_regs_struct, r9)},
+    {PERF_REG_X86_R10, offsetof(user_regs_struct, r10)},
+    {PERF_REG_X86_R11, offsetof(user_regs_struct, r11)},
+    {PERF_REG_X86_R12, offsetof(user_regs_struct, r12)},
+    {PERF_REG_X86_R13, offsetof(user_regs_struct, r13)},
+    {PERF_REG_X86_R14, offsetof(user_regs_struct, r14)},
+    {PERF_REG_X86_R15, offsetof(user_regs_struct, r15)},
+};
+
+template <class T>
+T take(const char** p) {
+    T value;
+    memcpy(&value, *p, sizeof(value));
+    *p += sizeof(value);
+    return value;
+}
+
+} // namespace
+
+PerfSampler::PerfSampler(const std::vector<pid_t>& pids, Profiler* profiler) :
+    pids_(pids),
+    profiler_(profiler),
+    lostSamples_(0),
+    lastCollect_(std::chrono::steady_clock::now()),
+    pendingPeriods_(0)
+{
+    const auto& options = profiler_->options_;
+    // Enough for a few heartbeats worth of samples taken on a CPU.
+    bufferPages_ = options.perfStackDumps ? 256 : 32;
+    std::sort(pids_.begin(), pids_.end());
+
+    // Threads created while we are at it inherit the events of their
+    // parents, unless the parents have not got them yet. Opening events
+    // again for the threads appeared meanwhile would count them twice.
+    int cpus = sysconf(_SC_NPROCESSORS_CONF);
+    std::vector<pid_t> tids;
+    for (pid_t pid: pids_) {
+        auto tasks = listTasks(pid);
+        tids.insert(tids.end(), tasks.begin(), tasks.end());
+    }
+    // Checked up front rather than running out of files halfway, and
+    // then of files for everything else.
+    size_t limit = raiseFileLimit();
+    size_t needed = tids.size() * cpus + openFiles() + SPARE_FILES;
+    if (needed > limit) {
+        throw std::runtime_error(str(boost::format(
+                "%d threads on %d CPUs need %d open files, the limit is %d") %
+                    tids.size() % cpus % needed % limit));
+    }
+    for (pid_t tid: tids) {
+        for (int cpu = 0; cpu != cpus; ++cpu) {
+            open(tid, cpu);
+        }
+    }
+    for (const auto& event: events_) {
+        throwErrnoIfMinus1(ioctl(event.get(), PERF_EVENT_IOC_ENABLE, 0));
+    }
+}
+
+void PerfSampler::open(pid_t tid, int cpu) {
+    const auto& options = profiler_->options_;
+
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_TASK_CLOCK;
+    // Task clock counts nanoseconds of the thread running on a CPU.
+    attr.sample_period = 1000000000 / options.perfFrequency;
+    attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME;
+    if (options.perfStackDumps) {
+        attr.sample_type |= PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+        for (const auto& reg: USER_REGS) {
+            attr.sample_regs_user |= 1ull << reg.perfReg;
+        }
+        attr.sample_stack_user = std::min(
+                options.stackSnapshotSize, MAX_STACK_DUMP) & ~7ul;
+    } else {
+        attr.sample_type |= PERF_SAMPLE_CALLCHAIN;
+        attr.exclude_callchain_kernel = 1;
+    }
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = syscall(
+            __NR_perf_event_open, &attr, tid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd == -1 && (errno == ESRCH || errno == ENODEV)) {
+        // Either the thread is gone already, or the CPU is offline.
+        return;
+    }
+    FileDescriptor event(throwErrnoIfMinus1(fd));
+
+    auto buffer = std::find_if(buffers_.begin(), buffers_.end(),
+            [=](const RingBuffer& buffer) { return buffer.cpu == cpu; });
+    if (buffer != buffers_.end()) {
+        throwErrnoIfMinus1(ioctl(event.get(), PERF_EVENT_IOC_SET_OUTPUT,
+                    buffer->event));
+    } else {
+        size_t size = (bufferPages_ + 1) * sysconf(_SC_PAGESIZE);
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED, event.get(), 0);
+        if (memory == MAP_FAILED) {
+            throwErrno();
+        }
+        buffers_.push_back({cpu, event.get(),
+                std::unique_ptr<void, std::function<void (void*)>>(
+                        memory, [=](void* memory) { munmap(memory, size); })});
+    }
+    events_.push_back(std::move(event));
+}
+
+void PerfSampler::collect(
+        const std::function<void (const SampleBatch&)>& f) {
+    samples_.clear();
+    for (auto& buffer: buffers_) {
+        readBuffer(&buffer, &samples_);
+    }
+    std::stable_sort(samples_.begin(), samples_.end(),
+            [](const Sample& a, const Sample& b) {
+                return a.time < b.time;
+            });
+
+    // Idle threads are not sampled at all, yet their time counts.
+    auto now = std::chrono::steady_clock::now();
+    pendingPeriods_ +=
+        std::chrono::duration<double>(now - lastCollect_).count() *
+        profiler_->options_.perfFrequency;
+    lastCollect_ = now;
+    size_t elapsed = pendingPeriods_;
+    pendingPeriods_ -= elapsed;
+
+    // A thread is sampled at most once per period, so consecutive
+    // samples of different threads go to the same period.
+    auto isInBatch = [&](pid_t tid) {
+        for (size_t i = 0; i != batch_.size(); ++i) {
+            if (batch_[i].tid() == tid) {
+                return true;
+            }
+        }
+        return false;
+    };
+    size_t periods = 0;
+    batch_.clear();
+    for (const auto& sample: samples_) {
+        if (isInBatch(sample.tid)) {
+            f(batch_);
+            ++periods;
+            batch_.clear();
+        }
+        batch_.add(sample.pid, sample.tid, sample.stacktrace);
+    }
+    if (!batch_.empty()) {
+        f(batch_);
+        ++periods;
+    }
+    batch_.clear();
+    for (; periods < elapsed; ++periods) {
+        f(batch_);
+    }
+}
+
+void PerfSampler::readBuffer(
+        RingBuffer* buffer, std::vector<Sample>* samples) {
+    auto* page = static_cast<perf_event_mmap_page *>(buffer->memory.get());
+    const char* data =
+        static_cast<const char *>(buffer->memory.get()) +
+        sysconf(_SC_PAGESIZE);
+    uint64_t size = bufferPages_ * sysconf(_SC_PAGESIZE);
+
+    uint64_t head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = page->data_tail;
+    while (tail < head) {
+        perf_event_header header;
+        // Records may wrap around the end of the buffer.
+        auto copy = [&](char* dest, size_t length) {
+            uint64_t begin = tail % size;
+            size_t first = std::min<uint64_t>(length, size - begin);
+            memcpy(dest, data + begin, first);
+            memcpy(dest + first, data, length - first);
+        };
+        copy(reinterpret_cast<char *>(&header), sizeof(header));
+        record_.resize(header.size);
+        copy(record_.data(), header.size);
+
+        if (header.type == PERF_RECORD_SAMPLE) {
+            Sample sample;
+            sample.stacktrace = parseSample(
+                    record_.data(), &sample.pid, &sample.tid, &sample.time);
+            if (!sample.stacktrace.empty()) {
+                samples->push_back(std::move(sample));
+            }
+        } else if (header.type == PERF_RECORD_LOST) {
+            const char* p = record_.data() + sizeof(header);
+            take<uint64_t>(&p); // id
+            lostSamples_ += take<uint64_t>(&p);
+        }
+        tail += header.size;
+    }
+    __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+void PerfSampler::housekeeping() {
+    isSampled_.clear();
+    for (auto iter = processes_.begin(); iter != processes_.end(); ) {
+        if (kill(iter->first, 0) == -1 && errno == ESRCH) {
+            iter = processes_.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+}
+
+std::vector<Frame> PerfSampler::parseSample(
+        const char* record, pid_t* pid, pid_t* tid, uint64_t* time) {
+    const auto& options = profiler_->options_;
+    std::vector<Frame> stacktrace;
+
+    // Fields follow in the order of PERF_SAMPLE_* bits.
+    const char* p = record + sizeof(perf_event_header);
+    *pid = take<uint32_t>(&p);
+    *tid = take<uint32_t>(&p);
+    *time = take<uint64_t>(&p);
+    if (!options.followForks &&
+            !std::binary_search(pids_.begin(), pids_.end(), *pid)) {
+        // A child which has inherited the events.
+        return stacktrace;
+    }
+    if (!isSampled(*pid, *tid)) {
+        return stacktrace;
+    }
+
+    if (!options.perfStackDumps) {
+        uint64_t nr = take<uint64_t>(&p);
+        for (uint64_t i = 0; i != nr; ++i) {
+            uint64_t ip = take<uint64_t>(&p);
+            // Context markers.
+            if (ip >= static_cast<uint64_t>(PERF_CONTEXT_MAX)) {
+                continue;
+            }
+            stacktrace.push_back({ip, 0});
+        }
+        profiler_->symbolizer_->resolveFunctions(*pid, &stacktrace);
+        return stacktrace;
+    }
+
+    StackSnapshot snapshot;
+    snapshot.tid = *tid;
+    memset(&snapshot.regs, 0, sizeof(snapshot.regs));
+    if (take<uint64_t>(&p) == PERF_SAMPLE_REGS_ABI_NONE) {
+        // Sampled in a kernel thread.
+        return stacktrace;
+    }
+    for (const auto& reg: USER_REGS) {
+        uint64_t value = take<uint64_t>(&p);
+        memcpy(reinterpret_cast<char *>(&snapshot.regs) + reg.offset,
+                &value, sizeof(value));
+    }
+    uint64_t stackSize = take<uint64_t>(&p);
+    const char* stack = p;
+    if (stackSize) {
+        p += stackSize;
+        stackSize = std::min(stackSize, take<uint64_t>(&p));
+    }
+    snapshot.stackStart = snapshot.regs.rsp;
+    snapshot.stack.assign(stack, stack + stackSize);
+
+    auto start = std::chrono::steady_clock::now();
+    Process* process = this->process(*pid);
+    stacktrace = process->unwinder->unwind(snapshot);
+    if (stacktrace.size() < 2 && process->fallbackUnwinder) {
+        stacktrace = process->fallbackUnwinder->unwind(snapshot);
+    }
+    profiler_->symbolizer_->resolveFunctions(*pid, &stacktrace);
+    profiler_->unwinding_.record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+    return stacktrace;
+}
+
+PerfSampler::Process* PerfSampler::process(pid_t pid) {
+    auto iter = processes_.find(pid);
+    if (iter != processes_.end()) {
+        return &iter->second;
+    }
+    Process process{
+        profiler_->addressSpace(pid),
+        {throwUnwindIf0(_UPT_create(pid)), &_UPT_destroy},
+        nullptr,
+        nullptr};
+    process.unwinder = profiler_->newUnwinder(
+            process.addressSpace.get(),
+            process.unwindInfo.get(),
+            &process.fallbackUnwinder);
+    return &processes_.emplace(pid, std::move(process)).first->second;
+}
+
+bool PerfSampler::isSampled(pid_t pid, pid_t tid) {
+    const auto& filter = profiler_->options_.threadFilter;
+    if (!filter.needsNames()) {
+        return filter.matches(tid, std::string());
+    }
+    auto iter = isSampled_.find(tid);
+    if (iter == isSampled_.end()) {
+        iter = isSampled_.emplace(
+                tid, filter.matches(tid, threadName(pid, tid))).first;
+    }
+    return iter->second;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "address_space.h"
+#include "file_descriptor.h"
+#include "frame.h"
+#include "sample_batch.h"
+#include "unwinder.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+class Profiler;
+
+// Samples all the threads of some processes with perf_event_open
+// task-clock events, so that the threads are never stopped. Threads and
+// processes created later inherit the events of their parents, samples
+// of forked children are dropped unless following forks. Inherited
+// events can only be mapped per CPU, so there is an event for every
+// thread and CPU, all writing to a single ring buffer per CPU. Each
+// sample carries either the callchain collected by the kernel (which
+// follows frame pointers) or a copy of the user stack and registers
+// unwound here.
+//
+// Throws SyscallError when perf events are not permitted, and
+// runtime_error when there would not be enough files left for them
+// even with the limit raised. Events opened so far are closed then.
+class PerfSampler {
+public:
+    PerfSampler(const std::vector<pid_t>& pids, Profiler* profiler);
+
+    // Passes samples taken since the previous call to f, one batch per
+    // sampling period. Periods in which no thread has been running
+    // are passed as empty batches.
+    void collect(const std::function<void (const SampleBatch&)>& f);
+
+    uint64_t lostSamples() const { return lostSamples_; }
+
+    // To be called about once a second: forgets the processes which are
+    // gone, and reads the names of the threads again for the filter.
+    void housekeeping();
+
+private:
+    struct RingBuffer {
+        int cpu;
+        // The event the buffer is mapped from.
+        int event;
+        std::unique_ptr<void, std::function<void (void*)>> memory;
+    };
+
+    struct Sample {
+        uint64_t time;
+        pid_t pid;
+        pid_t tid;
+        std::vector<Frame> stacktrace;
+    };
+
+    // What it takes to unwind stack dumps of a process.
+    struct Process {
+        std::shared_ptr<AddressSpace> addressSpace;
+        std::unique_ptr<
+            void,
+            void (*)(void *)> unwindInfo;
+        std::unique_ptr<Unwinder> unwinder;
+        std::unique_ptr<Unwinder> fallbackUnwinder;
+    };
+
+    void open(pid_t tid, int cpu);
+    void readBuffer(RingBuffer* buffer, std::vector<Sample>* samples);
+    std::vector<Frame> parseSample(const char* record, pid_t* pid,
+            pid_t* tid, uint64_t* time);
+    Process* process(pid_t pid);
+    bool isSampled(pid_t pid, pid_t tid);
+
+    // Sorted.
+    std::vector<pid_t> pids_;
+    Profiler* profiler_;
+    std::vector<FileDescriptor> events_;
+    std::vector<RingBuffer> buffers_;
+    size_t bufferPages_;
+
+    std::map<pid_t, Process> processes_;
+    // Whether threads pass the filter of the profiler, by tid.
+    std::unordered_map<pid_t, bool> isSampled_;
+
+    std::vector<char> record_;
+    std::vector<Sample> samples_;
+    SampleBatch batch_;
+    uint64_t lostSamples_;
+    std::chrono::steady_clock::time_point lastCollect_;
+    double pendingPeriods_;
+};
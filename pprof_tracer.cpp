@@ -0,0 +1,320 @@
+#include "pprof_tracer.h"
+#include "exception.h"
+#include "mappings.h"
+#include "protobuf_writer.h"
+#include "symbolizer.h"
+#include "thread_pool.h"
+
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <unordered_set>
+
+#include <zlib.h>
+
+namespace {
+
+const int SNAPSHOT_SECONDS = 60;
+
+// Field numbers from profile.proto.
+namespace Profile {
+const int SAMPLE_TYPE = 1;
+const int SAMPLE = 2;
+const int MAPPING = 3;
+const int LOCATION = 4;
+const int FUNCTION = 5;
+const int STRING_TABLE = 6;
+const int TIME_NANOS = 9;
+const int DURATION_NANOS = 10;
+const int PERIOD_TYPE = 11;
+const int PERIOD = 12;
+} // namespace Profile
+
+namespace ValueType {
+const int TYPE = 1;
+const int UNIT = 2;
+} // namespace ValueType
+
+namespace Sample {
+const int LOCATION_ID = 1;
+const int VALUE = 2;
+const int LABEL = 3;
+} // namespace Sample
+
+namespace Label {
+const int KEY = 1;
+const int NUM = 3;
+} // namespace Label
+
+namespace MappingField {
+const int ID = 1;
+const int MEMORY_START = 2;
+const int MEMORY_LIMIT = 3;
+const int FILE_OFFSET = 4;
+const int FILENAME = 5;
+const int HAS_FUNCTIONS = 7;
+} // namespace MappingField
+
+namespace Location {
+const int ID = 1;
+const int MAPPING_ID = 2;
+const int ADDRESS = 3;
+const int LINE = 4;
+} // namespace Location
+
+namespace Line {
+const int FUNCTION_ID = 1;
+} // namespace Line
+
+namespace Function {
+const int ID = 1;
+const int NAME = 2;
+const int SYSTEM_NAME = 3;
+} // namespace Function
+
+// Indexes strings into the string table, which starts with "".
+class StringTable {
+public:
+    StringTable() { index(""); }
+
+    uint64_t index(const std::string& s) {
+        auto iter = indexes_.find(s);
+        if (iter != indexes_.end()) {
+            return iter->second;
+        }
+        indexes_.emplace(s, strings_.size());
+        strings_.push_back(s);
+        return strings_.size() - 1;
+    }
+
+    void write(ProtobufWriter* profile) const {
+        for (const auto& s: strings_) {
+            profile->bytes(Profile::STRING_TABLE, s);
+        }
+    }
+
+private:
+    std::unordered_map<std::string, uint64_t> indexes_;
+    std::vector<std::string> strings_;
+};
+
+int64_t nanoseconds(std::chrono::system_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+} // namespace
+
+PprofTracer::PprofTracer(
+        const std::string& prefix,
+        int sampling,
+        Symbolizer* symbolizer) :
+    prefix_(prefix),
+    sampling_(sampling),
+    symbolizer_(symbolizer),
+    snapshots_(0),
+    writer_(new ThreadPool(1))
+{
+    startSnapshot();
+}
+
+PprofTracer::~PprofTracer() {
+    postSnapshot();
+    writer_.reset();
+    if (!error_.empty()) {
+        std::cerr << "pprof: " << error_ << std::endl;
+    }
+}
+
+void PprofTracer::tick(const SampleBatch& batch) {
+    for (size_t i = 0; i != batch.size(); ++i) {
+        const auto& stacktrace = batch[i];
+        if (!stacktrace.size()) {
+            continue;
+        }
+        ips_.clear();
+        ips_.push_back(stacktrace.pid());
+        auto& functions = snapshot_->functions[stacktrace.pid()];
+        for (const auto& frame: stacktrace) {
+            ips_.push_back(frame.ip);
+            functions[frame.ip] = frame.function;
+        }
+        auto iter = snapshot_->counts.find(ips_);
+        if (iter == snapshot_->counts.end()) {
+            snapshot_->counts.emplace(ips_, 1);
+        } else {
+            ++iter->second;
+        }
+    }
+
+    ++snapshot_->ticks;
+    // By time rather than ticks, the sampling rate may vary.
+    if (std::chrono::system_clock::now() - snapshot_->start >=
+            std::chrono::seconds(SNAPSHOT_SECONDS)) {
+        {
+            std::unique_lock<std::mutex> lock(errorMutex_);
+            if (!error_.empty()) {
+                throw std::runtime_error("pprof: " + error_);
+            }
+        }
+        postSnapshot();
+        startSnapshot();
+    }
+}
+
+void PprofTracer::startSnapshot() {
+    snapshot_.reset(new Snapshot);
+    snapshot_->index = snapshots_++;
+    snapshot_->ticks = 0;
+    snapshot_->start = std::chrono::system_clock::now();
+}
+
+void PprofTracer::postSnapshot() {
+    snapshot_->end = std::chrono::system_clock::now();
+    // std::function wants a copyable task.
+    std::shared_ptr<Snapshot> snapshot(std::move(snapshot_));
+    writer_->post([=] {
+        try {
+            write(*snapshot);
+        } catch (const std::exception& e) {
+            std::unique_lock<std::mutex> lock(errorMutex_);
+            error_ = e.what();
+        }
+    });
+}
+
+void PprofTracer::write(const Snapshot& snapshot) {
+    ProtobufWriter profile;
+    ProtobufWriter message;
+    StringTable strings;
+
+    auto valueType = [&](int field, const char* type, const char* unit) {
+        message.clear();
+        message.varint(ValueType::TYPE, strings.index(type));
+        message.varint(ValueType::UNIT, strings.index(unit));
+        profile.message(field, message);
+    };
+    valueType(Profile::SAMPLE_TYPE, "samples", "count");
+    valueType(Profile::SAMPLE_TYPE, "cpu", "nanoseconds");
+
+    // Locations are numbered by pid and ip, functions by FunctionId
+    // plus one; zero ids are not allowed.
+    std::map<std::pair<pid_t, unw_word_t>, uint64_t> locations;
+    // What a sample stands for, on average if the rate has varied.
+    int64_t duration = nanoseconds(snapshot.end - snapshot.start);
+    int64_t period = snapshot.ticks ?
+        duration / snapshot.ticks :
+        1000000000 / sampling_;
+    std::vector<uint64_t> locationIds;
+    ProtobufWriter label;
+    uint64_t pidKey = strings.index("pid");
+    for (const auto& kv: snapshot.counts) {
+        pid_t pid = kv.first[0];
+        locationIds.clear();
+        for (size_t i = 1; i != kv.first.size(); ++i) {
+            auto iter = locations.emplace(
+                    std::make_pair(pid, kv.first[i]),
+                    locations.size() + 1).first;
+            locationIds.push_back(iter->second);
+        }
+        message.clear();
+        message.packed(Sample::LOCATION_ID, locationIds);
+        message.packed(Sample::VALUE, {kv.second, kv.second * period});
+        label.clear();
+        label.varint(Label::KEY, pidKey);
+        label.varint(Label::NUM, pid);
+        message.message(Sample::LABEL, label);
+        profile.message(Profile::SAMPLE, message);
+    }
+
+    // Mappings are numbered in the order of processes and addresses.
+    // Processes which are gone have none left to tell.
+    std::map<pid_t, std::vector<Mapping>> mappings;
+    std::map<pid_t, uint64_t> firstMappingIds;
+    uint64_t mappingId = 1;
+    for (const auto& kv: snapshot.functions) {
+        auto& processMappings = mappings[kv.first];
+        processMappings = readExecutableMappings(kv.first);
+        firstMappingIds[kv.first] = mappingId;
+        for (const auto& mapping: processMappings) {
+            message.clear();
+            message.varint(MappingField::ID, mappingId++);
+            message.varint(MappingField::MEMORY_START, mapping.start);
+            message.varint(MappingField::MEMORY_LIMIT, mapping.end);
+            message.varint(MappingField::FILE_OFFSET, mapping.offset);
+            message.varint(
+                    MappingField::FILENAME, strings.index(mapping.path));
+            message.varint(MappingField::HAS_FUNCTIONS, 1);
+            profile.message(Profile::MAPPING, message);
+        }
+    }
+
+    std::unordered_set<FunctionId> functions;
+    ProtobufWriter line;
+    for (const auto& kv: locations) {
+        pid_t pid = kv.first.first;
+        unw_word_t ip = kv.first.second;
+        FunctionId function = snapshot.functions.at(pid).at(ip);
+        functions.insert(function);
+        message.clear();
+        message.varint(Location::ID, kv.second);
+        const auto& processMappings = mappings[pid];
+        const Mapping* mapping = findMapping(processMappings, ip);
+        if (mapping) {
+            message.varint(Location::MAPPING_ID, firstMappingIds[pid] +
+                    (mapping - &processMappings[0]));
+        }
+        message.varint(Location::ADDRESS, ip);
+        line.clear();
+        line.varint(Line::FUNCTION_ID, function + 1);
+        message.message(Location::LINE, line);
+        profile.message(Profile::LOCATION, message);
+    }
+
+    for (FunctionId function: functions) {
+        uint64_t name = strings.index(symbolizer_->name(function));
+        message.clear();
+        message.varint(Function::ID, function + 1);
+        message.varint(Function::NAME, name);
+        message.varint(Function::SYSTEM_NAME, name);
+        profile.message(Profile::FUNCTION, message);
+    }
+
+    strings.write(&profile);
+    profile.varint(Profile::TIME_NANOS,
+            nanoseconds(snapshot.start.time_since_epoch()));
+    profile.varint(Profile::DURATION_NANOS, duration);
+    message.clear();
+    message.varint(ValueType::TYPE, strings.index("cpu"));
+    message.varint(ValueType::UNIT, strings.index("nanoseconds"));
+    profile.message(Profile::PERIOD_TYPE, message);
+    profile.varint(Profile::PERIOD, period);
+
+    // Written aside and renamed, so that readers never see half a file.
+    std::string path = prefix_ + "." + std::to_string(snapshot.index) +
+        ".pb.gz";
+    std::string tmpPath = path + ".tmp";
+    gzFile file = gzopen(tmpPath.c_str(), "wb");
+    if (!file) {
+        throwErrno();
+    }
+    const auto& data = profile.data();
+    bool ok = gzwrite(file, data.data(), data.size()) ==
+        static_cast<int>(data.size());
+    if (gzclose(file) != Z_OK || !ok) {
+        unlink(tmpPath.c_str());
+        throw std::runtime_error("failed to write " + tmpPath);
+    }
+    throwErrnoIfMinus1(rename(tmpPath.c_str(), path.c_str()));
+}
+
+size_t PprofTracer::StackHash::operator()(
+        const std::vector<unw_word_t>& ips) const {
+    // FNV-1a over the ips.
+    uint64_t hash = 14695981039346656037ull;
+    for (unw_word_t ip: ips) {
+        hash = (hash ^ ip) * 1099511628211ull;
+    }
+    return hash;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "tracer.h"
+
+#include <libunwind.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+class Symbolizer;
+class ThreadPool;
+
+// Writes gzipped profile.proto snapshots, as read by `go tool pprof`,
+// to prefix.0.pb.gz, prefix.1.pb.gz and so on. Each snapshot covers the
+// samples since the previous one, of all the processes, with a "pid"
+// label to tell them apart. Encoding and compression happen on a
+// background thread, so collection goes on meanwhile.
+class PprofTracer : public Tracer {
+public:
+    PprofTracer(
+            const std::string& prefix,
+            int sampling,
+            Symbolizer* symbolizer);
+    // Writes the last snapshot.
+    ~PprofTracer();
+
+    // Throws if writing a previous snapshot has failed.
+    void tick(const SampleBatch& batch) override;
+    void addInfoLine(const std::string& /* info */) override {}
+
+private:
+    struct StackHash {
+        size_t operator()(const std::vector<unw_word_t>& ips) const;
+    };
+
+    struct Snapshot {
+        int index;
+        std::chrono::system_clock::time_point start;
+        std::chrono::system_clock::time_point end;
+        uint64_t ticks;
+        // Keyed by the pid followed by the ips, innermost first.
+        std::unordered_map<std::vector<unw_word_t>, uint64_t, StackHash>
+            counts;
+        std::unordered_map<
+            pid_t,
+            std::unordered_map<unw_word_t, FunctionId>> functions;
+    };
+
+    void startSnapshot();
+    void postSnapshot();
+    // Runs on the writer thread.
+    void write(const Snapshot& snapshot);
+
+    std::string prefix_;
+    int sampling_;
+    Symbolizer* symbolizer_;
+    int snapshots_;
+    std::unique_ptr<Snapshot> snapshot_;
+    std::vector<unw_word_t> ips_;
+
+    std::mutex errorMutex_;
+    std::string error_;
+    // Last, so that it is drained before the rest goes away.
+    std::unique_ptr<ThreadPool> writer_;
+};
@@ -1,166 +1,723 @@
 #include "profiler.h"
 #include "exception.h"
+#include "frame_pointer_unwinder.h"
+#include "libunwind_unwinder.h"
+#include "scope.h"
 #include "signal_handler.h"
+#include "symbolizer.h"
+#include "task_list.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
-#include <boost/lexical_cast.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <ostream>
 #include <set>
+#include <stdexcept>
 
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
-using boost::filesystem::directory_iterator;
-
 namespace {
 
-template <class F>
-void forallTids(pid_t pid, F f) {
-    for (directory_iterator i(str(
-                    boost::format("/proc/%d/task") % pid)), i_end;
-            i != i_end; ++i) {
-        if (!is_directory(i->status())) {
-            continue;
+std::string formatStats(const UnwindStats& stats) {
+    uint64_t samples = stats.samples;
+    return str(boost::format(
+            "%.1f us/sample, %.1f frames/sample, %d samples") %
+                (stats.nanoseconds / 1000.0 / samples) %
+                (static_cast<double>(stats.frames) / samples) %
+                samples);
+}
+
+void writeHistogram(std::ostream& out,
+        const std::string& name, const Histogram& histogram) {
+    out << boost::format(
+            "%s count=%d sum=%d p50=%d p90=%d p99=%d p999=%d max=%d\n") %
+        name %
+        histogram.count() %
+        histogram.sum() %
+        histogram.quantile(0.5) %
+        histogram.quantile(0.9) %
+        histogram.quantile(0.99) %
+        histogram.quantile(0.999) %
+        histogram.max();
+}
+
+} // namespace
+
+Profiler::Profiler(
+        const std::vector<pid_t>& pids,
+        const ProfilerOptions& options,
+        Symbolizer* symbolizer) :
+    pids_(pids),
+    options_(options),
+    symbolizer_(symbolizer),
+    unwindPool_(std::max(1u, std::min(4u,
+                    std::thread::hardware_concurrency()))),
+    attachNanoseconds_(0),
+    stacktraces_(0),
+    reusedStacktraces_(0),
+    ticks_(0),
+    lastTicks_(0),
+    lastStops_(0),
+    lastStoppedNanoseconds_(0),
+    maxFrequency_(0),
+    heartbeat_(nullptr),
+    isDetaching_(false),
+    commandsEvent_(throwErrnoIfMinus1(
+                eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))),
+    isDetachRequested_(false)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto attached = [&] {
+        attachNanoseconds_ =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+    };
+    std::sort(pids_.begin(), pids_.end());
+    pids_.erase(std::unique(pids_.begin(), pids_.end()), pids_.end());
+
+    if (options_.perfFrequency) {
+        try {
+            perfSampler_.reset(new PerfSampler(listProcesses(), this));
+            attached();
+            return;
+        } catch (const SyscallError& e) {
+            perfError_ = e.what();
+        } catch (const std::runtime_error& e) {
+            perfError_ = e.what();
         }
-        f(boost::lexical_cast<pid_t>(i->path().filename().string()));
     }
+
+    // Tracees report their stops with SIGCHLD, which is received
+    // with signalfd by the supervisor. It has to be blocked
+    // in every thread, and new threads inherit the mask.
+    blockSignals({SIGCHLD});
+
+    std::promise<void> ready;
+    supervisor_ = std::thread([&] { supervise(&ready); });
+    try {
+        ready.get_future().get();
+    } catch (...) {
+        supervisor_.join();
+        throw;
+    }
+    attached();
+}
+
+Profiler::~Profiler() {
+    if (perfSampler_) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(commandsMutex_);
+        isDetachRequested_ = true;
+    }
+    notifySupervisor();
+    supervisor_.join();
+}
+
+int Profiler::samplingFrequency(int heartbeatFrequency) const {
+    return perfSampler_ ? options_.perfFrequency : heartbeatFrequency;
+}
+
+void Profiler::eventLoop(
+        const std::vector<Tracer*>& tracers, Heartbeat* heartbeat) {
+    tracers_ = tracers;
+    bool isStaggered = heartbeat && options_.staggerStops && !perfSampler_;
+    if (isStaggered) {
+        startStaggeredRound(heartbeat);
+    } else {
+        doStacktraces();
+    }
+    if (!heartbeat) {
+        return;
+    }
+    maxFrequency_ = heartbeat->frequency();
+    heartbeat_ = heartbeat;
+    SCOPE_EXIT(heartbeat_ = nullptr);
+
+    // Every other thread blocks them already.
+    blockSignals({SIGINT, SIGTERM});
+    sigset_t set;
+    throwErrnoIfMinus1(sigemptyset(&set));
+    throwErrnoIfMinus1(sigaddset(&set, SIGINT));
+    throwErrnoIfMinus1(sigaddset(&set, SIGTERM));
+    FileDescriptor signals(throwErrnoIfMinus1(
+                signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC)));
+    loop_.add(signals.get(), [&] {
+        signalfd_siginfo info;
+        while (read(signals.get(), &info, sizeof(info)) > 0) {
+        }
+        loop_.stop();
+    });
+    SCOPE_EXIT(loop_.remove(signals.get()));
+
+    loop_.add(heartbeat->fd(), [&] {
+        if (!heartbeat->beat()) {
+            return;
+        }
+        if (isStaggered) {
+            finishStaggeredRound();
+        }
+        housekeeping(heartbeat);
+        if (heartbeat->skippedBeats() > 0) {
+            addInfoLine(str(boost::format(
+                "Too slow, skipping %d beats...") %
+                    heartbeat->skippedBeats()));
+        }
+        if (isStaggered) {
+            startStaggeredRound(heartbeat);
+        } else {
+            doStacktraces();
+        }
+    });
+    SCOPE_EXIT(loop_.remove(heartbeat->fd()));
+
+    loop_.run();
+}
+
+void Profiler::setFrequency(int freq) {
+    if (perfSampler_) {
+        throw std::runtime_error(str(boost::format(
+                "perf events sample at %d Hz") % options_.perfFrequency));
+    }
+    if (!heartbeat_) {
+        throw std::runtime_error("Not sampling periodically");
+    }
+    maxFrequency_ = freq;
+    heartbeat_->setFrequency(freq);
+}
+
+void Profiler::addTracerCost(
+        const std::string& tracer, const Histogram* tickDurations) {
+    tracerCosts_.emplace_back(tracer, tickDurations);
 }
 
-std::map<pid_t, StoppedWat> attachAllThreads(pid_t pid, Profiler* profiler) {
+void Profiler::writeStats(std::ostream& out) const {
+    writeHistogram(out, "stop_latency_ns", stopLatency_);
+    writeHistogram(out, "stopped_ns", stopped_);
+    writeHistogram(out, "stacktrace_ns", unwinding_);
+    writeHistogram(out, "tracers_enqueue_ns", enqueueing_);
+    for (const auto& cost: tracerCosts_) {
+        writeHistogram(out, cost.first + "_tracer_tick_ns", *cost.second);
+    }
+    out << boost::format("symbol_cache hits=%d misses=%d\n") %
+        symbolizer_->cacheHits() % symbolizer_->cacheMisses();
+    out << boost::format("stacktraces count=%d reused=%d\n") %
+        stacktraces_ % reusedStacktraces_;
+    out << boost::format("attach ns=%d\n") % attachNanoseconds_;
+}
+
+std::shared_ptr<AddressSpace> Profiler::addressSpace(pid_t pid) {
+    std::unique_lock<std::mutex> lock(addressSpacesMutex_);
+    auto& addressSpace = addressSpaces_[pid];
+    if (!addressSpace) {
+        addressSpace = std::make_shared<AddressSpace>();
+    }
+    return addressSpace;
+}
+
+std::unique_ptr<Unwinder> Profiler::newUnwinder(
+        AddressSpace* addressSpace,
+        void* upt,
+        std::unique_ptr<Unwinder>* fallback) {
+    auto libunwind = std::unique_ptr<Unwinder>(new LibunwindUnwinder(
+                addressSpace->get(), upt, &libunwindStats_));
+    switch (options_.unwindMethod) {
+        case UnwindMethod::LIBUNWIND:
+            break;
+        case UnwindMethod::FRAME_POINTER:
+            *fallback = std::move(libunwind);
+            return std::unique_ptr<Unwinder>(
+                    new FramePointerUnwinder(&framePointerStats_));
+    }
+    return libunwind;
+}
+
+std::vector<pid_t> Profiler::listProcesses() const {
+    auto pids = pids_;
+    if (options_.followForks) {
+        for (pid_t pid: pids_) {
+            auto descendants = listDescendants(pid);
+            pids.insert(pids.end(), descendants.begin(), descendants.end());
+        }
+        std::sort(pids.begin(), pids.end());
+        pids.erase(std::unique(pids.begin(), pids.end()), pids.end());
+    }
+    return pids;
+}
+
+void Profiler::newThread(pid_t pid, pid_t tid) {
+    if (wats_.count(tid)) {
+        // Has reported its initial stop already.
+        return;
+    }
+    auto wat = std::make_shared<WatTracer>(pid, tid, this);
+    if (isDetaching_ || options_.threadFilter.excludes(tid)) {
+        wat->detach();
+    }
+    wats_.emplace(tid, std::move(wat));
+}
+
+void Profiler::onUnwound(pid_t tid) {
+    {
+        std::unique_lock<std::mutex> lock(commandsMutex_);
+        unwound_.push_back(tid);
+    }
+    notifySupervisor();
+}
+
+void Profiler::supervise(std::promise<void>* ready) {
+    // Signals are the business of the event loop, SIGCHLD is blocked
+    // already.
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+    try {
+        FileDescriptor epoll;
+        FileDescriptor sigchld;
+        std::vector<pid_t> stopped;
+        try {
+            stopped = attachAllThreads();
+
+            epoll.reset(throwErrnoIfMinus1(epoll_create1(EPOLL_CLOEXEC)));
+            sigset_t set;
+            throwErrnoIfMinus1(sigemptyset(&set));
+            throwErrnoIfMinus1(sigaddset(&set, SIGCHLD));
+            sigchld.reset(throwErrnoIfMinus1(
+                        signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC)));
+            stopTimer_.reset(throwErrnoIfMinus1(timerfd_create(
+                            CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)));
+            for (int fd: {
+                    sigchld.get(), commandsEvent_.get(), stopTimer_.get()}) {
+                epoll_event event{};
+                event.events = EPOLLIN;
+                throwErrnoIfMinus1(epoll_ctl(
+                            epoll.get(), EPOLL_CTL_ADD, fd, &event));
+            }
+        } catch (...) {
+            ready->set_exception(std::current_exception());
+            return;
+        }
+
+        for (pid_t tid: stopped) {
+            auto iter = wats_.find(tid);
+            try {
+                iter->second->cont();
+            } catch (const ThreadIsGone&) {
+                wats_.erase(iter);
+            }
+        }
+        ready->set_value();
+
+        for (;;) {
+            runCommands();
+            runScheduledStops();
+
+            int status;
+            pid_t tid;
+            while ((tid = waitpid(-1, &status, __WALL | WNOHANG)) > 0) {
+                onTraceeStatusChanged(tid, status);
+            }
+            if (tid < 0 && errno != ECHILD && errno != EINTR) {
+                throwErrno();
+            }
+
+            if (isDetaching_ && wats_.empty()) {
+                break;
+            }
+
+            epoll_event events[3];
+            if (epoll_wait(epoll.get(), events, 3, -1) < 0) {
+                if (errno != EINTR) {
+                    throwErrno();
+                }
+            }
+            signalfd_siginfo info;
+            while (read(sigchld.get(), &info, sizeof(info)) > 0) {
+            }
+            uint64_t count;
+            while (read(commandsEvent_.get(), &count, sizeof(count)) > 0) {
+            }
+            while (read(stopTimer_.get(), &count, sizeof(count)) > 0) {
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << ">>> Oh no you don't! " << e.what() << std::endl;
+        raise(SIGABRT);
+    }
+}
+
+std::vector<pid_t> Profiler::attachAllThreads() {
     bool tracedSomething = true;
-    std::map<pid_t, StoppedWat> wats;
+    std::set<pid_t> gone;
+    std::vector<pid_t> stopped;
 
+    // Children forked before their parents are attached are not
+    // traced automatically, so they are looked for again every time.
     while (tracedSomething) {
         tracedSomething = false;
-        forallTids(pid, [&](pid_t tid) {
-            if (!wats.count(tid)) {
+        for (pid_t pid: listProcesses()) {
+            std::vector<pid_t> tids;
+            try {
+                tids = listTasks(pid);
+            } catch (const boost::filesystem::filesystem_error&) {
+                if (std::binary_search(pids_.begin(), pids_.end(), pid)) {
+                    throw;
+                }
+                // A child which has exited meanwhile.
+                continue;
+            }
+            for (pid_t tid: tids) {
+                if (wats_.count(tid) || gone.count(tid) ||
+                        options_.threadFilter.excludes(tid)) {
+                    continue;
+                }
                 tracedSomething = true;
                 try {
-                    wats.emplace(tid, StoppedWat(pid, tid, profiler));
+                    auto wat = std::make_shared<WatTracer>(pid, tid, this);
+                    if (wat->attach()) {
+                        stopped.push_back(tid);
+                    }
+                    wats_.emplace(tid, std::move(wat));
                 } catch (const ThreadIsGone&) {
                     // Tough luck, moving on.
+                    gone.insert(tid);
                 }
             }
-        });
+        }
     }
-
-    return wats;
+    return stopped;
 }
 
-template <class Container>
-std::set<typename Container::key_type> keys(const Container& container) {
-    std::set<typename Container::key_type> keys;
-
-    for (const auto& kv: container) {
-        keys.insert(kv.first);
+void Profiler::onTraceeStatusChanged(pid_t tid, int status) {
+    auto iter = wats_.find(tid);
+    if (iter == wats_.end()) {
+        // A new thread may report its initial stop
+        // before the clone event of its parent.
+        if (!WIFSTOPPED(status)) {
+            return;
+        }
+        newThread(processOf(tid), tid);
+        iter = wats_.find(tid);
     }
 
-    return keys;
+    bool isAlive;
+    try {
+        isAlive = iter->second->onTraceeStatusChanged(status);
+    } catch (const ThreadIsGone&) {
+        isAlive = false;
+    }
+    if (!isAlive) {
+        wats_.erase(iter);
+    }
 }
 
-} // namespace
-
-Profiler::Profiler(pid_t pid) :
-    pid_(pid)
-{
-    auto stoppedWats = attachAllThreads(pid, this);
-
-    std::unique_lock<std::mutex> lock(mutex_);
-    for (auto& pair: stoppedWats) {
-        wats_.emplace(pair.first, std::move(pair.second).continueWat());
+void Profiler::runCommands() {
+    std::vector<std::shared_ptr<StacktraceRound>> rounds;
+    std::vector<pid_t> unwound;
+    bool doDetach;
+    {
+        std::unique_lock<std::mutex> lock(commandsMutex_);
+        rounds.swap(requestedRounds_);
+        unwound.swap(unwound_);
+        doDetach = isDetachRequested_;
     }
-}
 
-Profiler::~Profiler() {
-    std::unique_lock<std::mutex> stoppingNewThreads(skipNewThreadsMutex_);
-    std::unique_lock<std::mutex> stoppingEndedThreads(skipEndedThreadsMutex_);
-    std::unique_lock<std::mutex> lock(mutex_);
-    wats_.clear();
-}
+    auto forget = [&](pid_t tid, bool isAlive) {
+        if (!isAlive) {
+            wats_.erase(tid);
+        }
+    };
 
-void Profiler::eventLoop(Tracer* tracer, Heartbeat* heartbeat) {
-    doStacktraces(tracer);
-    if (!heartbeat) {
-        return;
+    for (pid_t tid: unwound) {
+        auto iter = wats_.find(tid);
+        if (iter == wats_.end()) {
+            continue;
+        }
+        try {
+            forget(tid, iter->second->onUnwound());
+        } catch (const ThreadIsGone&) {
+            forget(tid, false);
+        }
     }
-    handleSignals({SIGINT}, {});
-    for (;;) {
-        reapDead();
-        heartbeat->beat();
-        if (heartbeat->skippedBeats() > 0) {
-            tracer->addInfoLine(str(boost::format(
-                "Too slow, skipping %d beats...") %
-                    heartbeat->skippedBeats()));
+
+    for (const auto& round: rounds) {
+        if (round->spread().count()) {
+            // The previous round is over by now, but just in case.
+            for (auto& stop: scheduledStops_) {
+                stop.first = std::chrono::steady_clock::time_point();
+            }
+            runScheduledStops();
+            auto now = std::chrono::steady_clock::now();
+            // Every thread gets a slot of its own in the spread,
+            // and a random time within it.
+            std::uniform_real_distribution<double> jitter(0, 1);
+            double slot = static_cast<double>(round->spread().count()) /
+                std::max<size_t>(wats_.size(), 1);
+            size_t i = 0;
+            for (const auto& kv: wats_) {
+                scheduledStops_.emplace_back(
+                        now + std::chrono::microseconds(static_cast<int64_t>(
+                                slot * (i++ + jitter(random_)))),
+                        kv.first);
+            }
+            scheduledRound_ = round;
+            continue;
         }
-        if (lastSignal() == SIGINT) {
-            break;
+        std::vector<pid_t> gone;
+        for (const auto& kv: wats_) {
+            if (!kv.second->requestStacktrace(round)) {
+                gone.push_back(kv.first);
+            }
         }
-        while (heartbeat->usecondsUntilNextBeat()) {
-            resetLastSignal();
-            if (usleep(std::max(1ul, heartbeat->usecondsUntilNextBeat())) < 0) {
-                if (lastSignal() == SIGINT) {
-                    return;
-                }
+        for (pid_t tid: gone) {
+            forget(tid, false);
+        }
+        round->seal();
+    }
+
+    if (doDetach && !isDetaching_) {
+        isDetaching_ = true;
+        scheduledStops_.clear();
+        scheduledRound_.reset();
+        std::vector<pid_t> gone;
+        for (const auto& kv: wats_) {
+            try {
+                kv.second->detach();
+            } catch (const ThreadIsGone&) {
+                gone.push_back(kv.first);
             }
         }
-        doStacktraces(tracer);
+        for (pid_t tid: gone) {
+            forget(tid, false);
+        }
+    }
+}
+
+void Profiler::runScheduledStops() {
+    auto now = std::chrono::steady_clock::now();
+    while (!scheduledStops_.empty() && scheduledStops_.front().first <= now) {
+        pid_t tid = scheduledStops_.front().second;
+        scheduledStops_.pop_front();
+        auto iter = wats_.find(tid);
+        if (iter != wats_.end() &&
+                !iter->second->requestStacktrace(scheduledRound_)) {
+            wats_.erase(iter);
+        }
+    }
+    if (scheduledStops_.empty()) {
+        if (scheduledRound_) {
+            scheduledRound_->seal();
+            scheduledRound_.reset();
+        }
+        return;
     }
+
+    // steady_clock is CLOCK_MONOTONIC.
+    auto next = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            scheduledStops_.front().first.time_since_epoch()).count();
+    itimerspec timer{};
+    timer.it_value.tv_sec = next / 1000000000;
+    timer.it_value.tv_nsec = next % 1000000000;
+    throwErrnoIfMinus1(timerfd_settime(
+                stopTimer_.get(), TFD_TIMER_ABSTIME, &timer, nullptr));
+}
+
+void Profiler::notifySupervisor() {
+    uint64_t one = 1;
+    throwErrnoIfMinus1(write(commandsEvent_.get(), &one, sizeof(one)));
 }
 
-void Profiler::newThread(pid_t tid) {
-    std::unique_lock<std::mutex> stoppingLock(
-            skipNewThreadsMutex_, std::try_to_lock);
-    if (!stoppingLock.owns_lock()) {
+void Profiler::doStacktraces() {
+    if (perfSampler_) {
+        perfSampler_->collect([&](const SampleBatch& batch) { tick(batch); });
         return;
     }
 
-    try {
-        StoppedWat stoppedWat(pid_, tid, this);
+    batch_.clear();
+    auto round = std::make_shared<StacktraceRound>(&batch_);
+    {
+        std::unique_lock<std::mutex> lock(commandsMutex_);
+        requestedRounds_.push_back(round);
+    }
+    notifySupervisor();
+    round->wait();
 
-        std::unique_lock<std::mutex> lock(mutex_);
-        wats_.emplace(tid, std::move(stoppedWat).continueWat());
-    } catch (const ThreadIsGone&) {
+    for (const auto& error: round->errors()) {
+        addInfoLine(error);
     }
+    stacktraces_ += batch_.size();
+    ++ticks_;
+    tick(batch_);
 }
 
-void Profiler::endThread(pid_t tid) {
-    std::unique_lock<std::mutex> stoppingLock(
-            skipEndedThreadsMutex_, std::try_to_lock);
-    if (!stoppingLock.owns_lock()) {
+void Profiler::finishStaggeredRound() {
+    if (!staggeredRound_) {
         return;
     }
+    staggeredRound_->wait();
+    for (const auto& error: staggeredRound_->errors()) {
+        addInfoLine(error);
+    }
+    staggeredRound_.reset();
+    stacktraces_ += batch_.size();
+    ++ticks_;
+    tick(batch_);
+}
+
+void Profiler::startStaggeredRound(Heartbeat* heartbeat) {
+    batch_.clear();
+    // Leaving time for the last threads to be unwound before the beat.
+    staggeredRound_ = std::make_shared<StacktraceRound>(&batch_,
+            std::chrono::microseconds(
+                750000 / heartbeat->frequency()));
+    {
+        std::unique_lock<std::mutex> lock(commandsMutex_);
+        requestedRounds_.push_back(staggeredRound_);
+    }
+    notifySupervisor();
+}
+
+void Profiler::tick(const SampleBatch& batch) {
+    auto start = std::chrono::steady_clock::now();
+    for (Tracer* tracer: tracers_) {
+        tracer->tick(batch);
+    }
+    enqueueing_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+}
+
+void Profiler::addInfoLine(const std::string& info) {
+    for (Tracer* tracer: tracers_) {
+        tracer->addInfoLine(info);
+    }
+}
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    zombies_.push_back(tid);
+void Profiler::setStatus(const std::string& name, const std::string& value) {
+    for (Tracer* tracer: tracers_) {
+        tracer->setStatus(name, value);
+    }
 }
 
-void Profiler::doStacktraces(Tracer* tracer) {
-    std::map<pid_t, std::future<std::vector<Frame>>> stacktraceFutures;
+void Profiler::housekeeping(Heartbeat* heartbeat) {
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = now - lastHousekeeping_;
+    if (elapsed < std::chrono::seconds(1)) {
+        return;
+    }
+    bool isFirst = lastHousekeeping_ == decltype(now)();
+    lastHousekeeping_ = now;
+    if (!perfSampler_ && !isFirst) {
+        adjustSampling(heartbeat,
+                std::chrono::duration<double>(elapsed).count());
+    }
+
+    // No thread is being unwound between the beats.
+    bool isRemapped = symbolizer_->refreshMappings();
+    if (perfSampler_) {
+        perfSampler_->housekeeping();
+    }
     {
-        std::unique_lock<std::mutex> lock(mutex_);
-        for (auto& kv: wats_) {
-            try {
-                stacktraceFutures.emplace(kv.first, kv.second.stacktrace());
-            } catch (const std::exception& e) {
-                tracer->addInfoLine(std::string("Exception: ") + e.what());
+        std::unique_lock<std::mutex> lock(addressSpacesMutex_);
+        for (auto iter = addressSpaces_.begin();
+                iter != addressSpaces_.end(); ) {
+            if (iter->second.use_count() == 1) {
+                // Nothing unwinds that process anymore.
+                iter = addressSpaces_.erase(iter);
+            } else {
+                if (isRemapped) {
+                    iter->second->flush();
+                }
+                ++iter;
             }
         }
     }
-    std::map<pid_t, std::vector<Frame>> stacktraces;
-    for (auto& kv: stacktraceFutures) {
-        try {
-            stacktraces.emplace(kv.first, kv.second.get());
-        } catch (const std::exception& e) {
-            tracer->addInfoLine(std::string("Exception: ") + e.what());
-        }
+
+    if (perfSampler_) {
+        setStatus("sampling", str(boost::format(
+                "perf events at %d Hz, %d samples lost") %
+                    options_.perfFrequency %
+                    perfSampler_->lostSamples()));
+    } else if (!perfError_.empty()) {
+        setStatus("sampling", "ptrace, perf events failed: " + perfError_);
+    }
+    if (stacktraces_) {
+        setStatus("idle threads", str(boost::format(
+                "%.1f%% of stacktraces reused without stopping") %
+                    (100.0 * reusedStacktraces_ / stacktraces_)));
+    }
+    if (libunwindStats_.samples) {
+        setStatus("libunwind", formatStats(libunwindStats_));
+    }
+    if (framePointerStats_.samples) {
+        setStatus("frame pointers", formatStats(framePointerStats_));
     }
 
-    tracer->tick(std::move(stacktraces));
+    for (const auto& histogram: {
+            std::make_pair("cost: stop latency", &stopLatency_),
+            std::make_pair("cost: stopped", &stopped_),
+            std::make_pair("cost: stacktrace", &unwinding_),
+            std::make_pair("cost: enqueueing ticks", &enqueueing_)}) {
+        if (histogram.second->count()) {
+            setStatus(histogram.first, formatDurations(*histogram.second));
+        }
+    }
+    for (const auto& cost: tracerCosts_) {
+        if (cost.second->count()) {
+            setStatus("cost: " + cost.first + " tracer",
+                    formatDurations(*cost.second));
+        }
+    }
+    uint64_t hits = symbolizer_->cacheHits();
+    uint64_t lookups = hits + symbolizer_->cacheMisses();
+    if (lookups) {
+        setStatus("cost: symbol cache", str(boost::format(
+                "%.2f%% hits of %d lookups") %
+                    (100.0 * hits / lookups) % lookups));
+    }
 }
 
-void Profiler::reapDead() {
-    for (pid_t zombie: zombies_) {
-        wats_.erase(zombie);
+void Profiler::adjustSampling(Heartbeat* heartbeat, double seconds) {
+    uint64_t stops = stopped_.count();
+    uint64_t stoppedNanoseconds = stopped_.sum();
+    double rate = (ticks_ - lastTicks_) / seconds;
+    uint64_t newStops = stops - lastStops_;
+    double stopNanoseconds = newStops ?
+        static_cast<double>(stoppedNanoseconds - lastStoppedNanoseconds_) /
+            newStops :
+        0;
+    lastTicks_ = ticks_;
+    lastStops_ = stops;
+    lastStoppedNanoseconds_ = stoppedNanoseconds;
+
+    // A thread running all the time is stopped on every tick.
+    std::string budget;
+    if (options_.overheadBudget) {
+        budget = str(boost::format(", budget %.2f%%") %
+                (options_.overheadBudget * 100));
+        if (stopNanoseconds) {
+            double target = options_.overheadBudget * 1e9 / stopNanoseconds;
+            // Halfway there on a log scale, stop times are noisy.
+            double frequency = std::sqrt(target * heartbeat->frequency());
+            heartbeat->setFrequency(std::max(1, std::min(maxFrequency_,
+                            static_cast<int>(frequency))));
+        }
     }
-    zombies_.clear();
+    setStatus("rate", str(boost::format(
+            "%.0f Hz, %.1f us stopped per sample, "
+                "%.3f%% of thread time%s") %
+                rate %
+                (stopNanoseconds / 1000) %
+                (rate * stopNanoseconds / 1e7) %
+                budget));
 }
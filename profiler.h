@@ -1,35 +1,219 @@
 #pragma once
 
+#include "address_space.h"
+#include "event_loop.h"
+#include "file_descriptor.h"
+#include "histogram.h"
 #include "heartbeat.h"
+#include "perf_sampler.h"
+#include "sample_batch.h"
+#include "thread_filter.h"
+#include "thread_pool.h"
 #include "tracer.h"
+#include "unwinder.h"
 #include "wat.h"
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <iosfwd>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <unistd.h>
 
+class Symbolizer;
+
+enum class UnwindMethod {
+    LIBUNWIND,
+    // Falls back to libunwind when there are no frame pointers.
+    FRAME_POINTER,
+};
+
+struct ProfilerOptions {
+    // That much of the stack is copied at once when a thread is stopped.
+    size_t stackSnapshotSize = 32 * 1024;
+    // Resume a thread as soon as its snapshot is taken
+    // instead of keeping it stopped until unwound.
+    bool unwindAfterResume = false;
+    UnwindMethod unwindMethod = UnwindMethod::LIBUNWIND;
+    // Sample that many times a second of each thread running on a CPU
+    // with perf_event_open instead of stopping threads, if permitted.
+    // Zero means always stopping threads with ptrace.
+    int perfFrequency = 0;
+    // Copy user stacks with perf samples and unwind them here instead of
+    // relying on callchains walked by the kernel along frame pointers.
+    bool perfStackDumps = false;
+    // Stop threads one at a time, spread over the heartbeat interval
+    // with jitter, instead of all at once. Stacktraces are passed to
+    // the tracers on the next beat.
+    bool staggerStops = false;
+    // Fraction of its time a thread may spend stopped. The sampling
+    // frequency is lowered as needed to stay within it. Zero means
+    // sampling at the heartbeat frequency whatever it costs.
+    double overheadBudget = 0;
+    // Also trace the children of the targets, those running already
+    // and those forked later, and their children in turn.
+    bool followForks = false;
+    // Threads left out are never stopped, and their perf samples
+    // are dropped.
+    ThreadFilter threadFilter;
+};
+
+// A single supervisor thread does all the ptrace work for every traced
+// thread of every target process, multiplexing them with waitpid(-1).
+// Unwinding is done on a small fixed pool of threads. When perf events
+// are asked for and permitted, no thread is traced, and samples are read
+// by PerfSampler. Batches mix the samples of all the processes.
 class Profiler {
 public:
-    explicit Profiler(pid_t pid);
+    Profiler(
+            const std::vector<pid_t>& pids,
+            const ProfilerOptions& options,
+            Symbolizer* symbolizer);
     ~Profiler();
 
-    void eventLoop(Tracer* tracer, Heartbeat* heartbeat);
+    // Samples per second of each thread the tracer is going to get.
+    int samplingFrequency(int heartbeatFrequency) const;
+
+    // Every batch is passed to all the tracers. Without heartbeat,
+    // takes a single batch. Otherwise takes one on every beat until
+    // SIGINT, SIGTERM or stop().
+    void eventLoop(
+            const std::vector<Tracer*>& tracers, Heartbeat* heartbeat);
+    // Other event sources may be added to the loop before it is run.
+    EventLoop* loop() { return &loop_; }
+    // May be called from any thread.
+    void stop() { loop_.stop(); }
+    // Beats that many times a second from now on, which also becomes
+    // the ceiling for the overhead budget. Called from the loop. Throws
+    // when perf events are used, they sample at their own frequency.
+    void setFrequency(int freq);
+
+    // Reports the time a tracer takes per tick along with the costs of
+    // wat itself. The histogram must outlive the loop and writeStats().
+    void addTracerCost(
+            const std::string& tracer, const Histogram* tickDurations);
+    // What wat has cost so far, one "name key=value..." line each.
+    void writeStats(std::ostream& out) const;
 
 private:
+    friend class PerfSampler;
     friend class WatTracer;
-    void newThread(pid_t tid);
-    void endThread(pid_t tid);
-
-    void doStacktraces(Tracer* tracer);
-    void reapDead();
-
-    pid_t pid_;
-    std::map<pid_t, Wat> wats_;
-    std::vector<pid_t> zombies_;
-    std::mutex mutex_;
-    std::mutex skipNewThreadsMutex_;
-    std::mutex skipEndedThreadsMutex_;
-};
 
+    // Shared by everything unwinding the threads of the process.
+    // May be called from any thread.
+    std::shared_ptr<AddressSpace> addressSpace(pid_t pid);
+    // Unwinder for options_.unwindMethod, and another one to be used
+    // when the first fails to go past the topmost frame, if needed.
+    std::unique_ptr<Unwinder> newUnwinder(
+            AddressSpace* addressSpace,
+            void* upt,
+            std::unique_ptr<Unwinder>* fallback);
+
+    // Targets and, when following forks, their descendants.
+    std::vector<pid_t> listProcesses() const;
+
+    // Called from the supervisor thread.
+    void newThread(pid_t pid, pid_t tid);
+    // Called from the unwind pool.
+    void onUnwound(pid_t tid);
+
+    void supervise(std::promise<void>* ready);
+    // Returns the threads left stopped.
+    std::vector<pid_t> attachAllThreads();
+    void onTraceeStatusChanged(pid_t tid, int status);
+    void runCommands();
+    // Stops the threads whose time has come, and arms stopTimer_
+    // for the next one.
+    void runScheduledStops();
+    void notifySupervisor();
+
+    void doStacktraces();
+    // Passes the stacktraces of the round started on the previous beat
+    // on, so that nothing is being unwound until the next one starts,
+    // spread over the heartbeat interval.
+    void finishStaggeredRound();
+    void startStaggeredRound(Heartbeat* heartbeat);
+    // Things to be done about once a second.
+    void housekeeping(Heartbeat* heartbeat);
+    // Reports the sampling rate and the time threads spend stopped,
+    // and keeps the latter within options_.overheadBudget.
+    void adjustSampling(Heartbeat* heartbeat, double seconds);
+
+    void tick(const SampleBatch& batch);
+    void addInfoLine(const std::string& info);
+    void setStatus(const std::string& name, const std::string& value);
+
+    std::vector<pid_t> pids_;
+    ProfilerOptions options_;
+    Symbolizer* symbolizer_;
+    std::mutex addressSpacesMutex_;
+    std::map<pid_t, std::shared_ptr<AddressSpace>> addressSpaces_;
+    UnwindStats libunwindStats_;
+    UnwindStats framePointerStats_;
+    std::chrono::steady_clock::time_point lastHousekeeping_;
+    std::vector<Tracer*> tracers_;
+    EventLoop loop_;
+    // Filled by the unwind pool, reused from tick to tick.
+    SampleBatch batch_;
+    ThreadPool unwindPool_;
+
+    std::unique_ptr<PerfSampler> perfSampler_;
+    // Why perf events are not used, if asked for.
+    std::string perfError_;
+
+    // From the start of the constructor until every thread is traced.
+    uint64_t attachNanoseconds_;
+
+    uint64_t stacktraces_;
+    // Taken from threads which have not run since the previous round.
+    std::atomic<uint64_t> reusedStacktraces_;
+    // What wat costs, in nanoseconds. From PTRACE_INTERRUPT until
+    // the stop is seen, from then until the thread is resumed, taking
+    // a stacktrace from a snapshot or a perf sample, and queueing a
+    // batch for the tracers. Then what each tracer takes per tick, by
+    // tracer name.
+    Histogram stopLatency_;
+    Histogram stopped_;
+    Histogram unwinding_;
+    Histogram enqueueing_;
+    std::vector<std::pair<std::string, const Histogram*>> tracerCosts_;
+    // Values at the last adjustSampling().
+    uint64_t ticks_;
+    uint64_t lastTicks_;
+    uint64_t lastStops_;
+    uint64_t lastStoppedNanoseconds_;
+    int maxFrequency_;
+    // While the loop runs with one.
+    Heartbeat* heartbeat_;
+
+    // Owned by the supervisor thread.
+    std::map<pid_t, std::shared_ptr<WatTracer>> wats_;
+    bool isDetaching_;
+    // Threads to be stopped for scheduledRound_, by time.
+    std::deque<std::pair<std::chrono::steady_clock::time_point, pid_t>>
+        scheduledStops_;
+    std::shared_ptr<StacktraceRound> scheduledRound_;
+    FileDescriptor stopTimer_;
+    std::minstd_rand random_;
+
+    // Requested by the main thread, in staggered mode.
+    std::shared_ptr<StacktraceRound> staggeredRound_;
+
+    // Commands for the supervisor thread.
+    std::mutex commandsMutex_;
+    FileDescriptor commandsEvent_;
+    std::vector<std::shared_ptr<StacktraceRound>> requestedRounds_;
+    std::vector<pid_t> unwound_;
+    bool isDetachRequested_;
+
+    std::thread supervisor_;
+};
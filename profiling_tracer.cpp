@@ -1,83 +1,297 @@
 #include "profiling_tracer.h"
 #include "text_table.h"
-#include "symbols.h"
+#include "symbolizer.h"
+#include "task_list.h"
 
 #include <boost/format.hpp>
 
-#include <algorithm>
 #include <set>
 
-#include <unistd.h>
+#include <curses.h>
 
 namespace {
 
-std::vector<Frame> removeDuplicatedFunctions(std::vector<Frame> frames) {
-    std::set<std::string> names;
-    auto seen = [&](const Frame& frame) {
-        if (names.count(frame.procName)) {
-            return true;
-        } else {
-            names.insert(frame.procName);
-            return false;
+const size_t TOP_SIZE = 30;
+const size_t NEIGHBOURS_SIZE = 14;
+// Threads not seen for that long are forgotten.
+const std::chrono::seconds THREAD_TIMEOUT(10);
+// Threads get renamed.
+const std::chrono::seconds THREADS_REFRESH_INTERVAL(1);
+// Samples shown, by time rather than ticks as the rate may vary.
+const std::chrono::seconds SHOWN_INTERVAL(10);
+
+} // namespace
+
+ProfilingTracer::ProfilingTracer(Symbolizer* symbolizer):
+    symbolizer_(symbolizer),
+    callTree_(SHOWN_INTERVAL),
+    groupTree_(SHOWN_INTERVAL),
+    grouping_(Grouping::ALL),
+    shownId_(0),
+    shownTree_(&callTree_),
+    sortBySelf_(false),
+    selected_(0)
+{}
+
+void ProfilingTracer::tick(const SampleBatch& batch) {
+    auto now = std::chrono::steady_clock::now();
+    callTree_.push(batch);
+    groupBatch_.clear();
+    for (size_t i = 0; i != batch.size(); ++i) {
+        pid_t tid = batch[i].tid();
+        auto iter = threads_.find(tid);
+        if (iter == threads_.end()) {
+            Thread thread{
+                batch[i].pid(), threadName(batch[i].pid(), tid), now};
+            iter = threads_.emplace(tid, std::move(thread)).first;
+        }
+        iter->second.lastSeen = now;
+        if (grouping_ != Grouping::ALL && isShown(tid, iter->second)) {
+            groupBatch_.add(batch[i]);
         }
-    };
-    frames.erase(
-            std::remove_if(frames.begin(), frames.end(), seen),
-            frames.end());
-    return frames;
+    }
+    if (grouping_ != Grouping::ALL) {
+        groupTree_.push(groupBatch_);
+    }
+
+    // By time rather than ticks, the sampling rate may vary.
+    if (now - lastRender_ >= std::chrono::milliseconds(100)) {
+        lastRender_ = now;
+        handleKeys();
+        render();
+    }
+}
+
+void ProfilingTracer::addInfoLine(const std::string& info) {
+    ++infoLines_[info];
 }
 
-std::vector<Frame> concatStacktraces(
-        std::map<pid_t, std::vector<Frame>> stacktraces) {
-    std::vector<Frame> result;
+void ProfilingTracer::setStatus(
+        const std::string& name, const std::string& value) {
+    status_[name] = value;
+}
 
-    for (auto& kv: stacktraces) {
-        if (result.empty()) {
-            result = removeDuplicatedFunctions(std::move(kv.second));
-        } else {
-            auto stacktrace = removeDuplicatedFunctions(std::move(kv.second));
-            result.insert(result.end(), stacktrace.begin(), stacktrace.end());
+void ProfilingTracer::showNext(Grouping grouping) {
+    bool isSame = grouping == grouping_;
+    grouping_ = Grouping::ALL;
+    if (grouping == Grouping::NAME) {
+        std::set<std::string> names;
+        for (const auto& kv: threads_) {
+            names.insert(kv.second.name);
+        }
+        auto next = isSame ? names.upper_bound(shownName_) : names.begin();
+        if (next != names.end()) {
+            grouping_ = grouping;
+            shownName_ = *next;
+        }
+    } else {
+        std::set<pid_t> ids;
+        for (const auto& kv: threads_) {
+            ids.insert(
+                    grouping == Grouping::PROCESS ? kv.second.pid : kv.first);
+        }
+        auto next = isSame ? ids.upper_bound(shownId_) : ids.begin();
+        if (next != ids.end()) {
+            grouping_ = grouping;
+            shownId_ = *next;
         }
     }
+    groupTree_ = CallTree(SHOWN_INTERVAL);
+    shownTree_ = grouping_ == Grouping::ALL ? &callTree_ : &groupTree_;
+    selected_ = 0;
+}
 
-    return result;
+bool ProfilingTracer::isShown(pid_t tid, const Thread& thread) const {
+    switch (grouping_) {
+        case Grouping::ALL:
+            break;
+        case Grouping::PROCESS:
+            return thread.pid == shownId_;
+        case Grouping::THREAD:
+            return tid == shownId_;
+        case Grouping::NAME:
+            return thread.name == shownName_;
+    }
+    return true;
 }
 
-} // namespace
+void ProfilingTracer::refreshThreads() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastThreadsRefresh_ < THREADS_REFRESH_INTERVAL) {
+        return;
+    }
+    lastThreadsRefresh_ = now;
+    for (auto iter = threads_.begin(); iter != threads_.end(); ) {
+        if (now - iter->second.lastSeen > THREAD_TIMEOUT) {
+            iter = threads_.erase(iter);
+            continue;
+        }
+        auto name = threadName(iter->second.pid, iter->first);
+        // Gone, the last name will do.
+        if (!name.empty()) {
+            iter->second.name = std::move(name);
+        }
+        ++iter;
+    }
+}
 
-ProfilingTracer::ProfilingTracer(int sampling):
-    statistic_(sampling * 10),
-    sampling_(sampling),
-    iteration_(0)
-{}
+std::string ProfilingTracer::describeShown() const {
+    switch (grouping_) {
+        case Grouping::ALL:
+            break;
+        case Grouping::PROCESS:
+            return str(boost::format(
+                    "Process %d, 'p' for the next one") % shownId_);
+        case Grouping::THREAD:
+            {
+                auto iter = threads_.find(shownId_);
+                bool isKnown = iter != threads_.end();
+                return str(boost::format(
+                        "Thread %d (%s) of process %d, "
+                            "'t' for the next one") %
+                            shownId_ %
+                            (isKnown ? iter->second.name : "") %
+                            (isKnown ? iter->second.pid : 0));
+            }
+        case Grouping::NAME:
+            return str(boost::format(
+                    "Threads named %s, 'c' for the next name") % shownName_);
+    }
+    std::set<pid_t> pids;
+    std::set<std::string> names;
+    for (const auto& kv: threads_) {
+        pids.insert(kv.second.pid);
+        names.insert(kv.second.name);
+    }
+    return str(boost::format(
+            "All samples: %d processes, %d threads, %d thread names, "
+                "'p', 't' or 'c' for one at a time") %
+                pids.size() % threads_.size() % names.size());
+}
 
-void ProfilingTracer::tick(std::map<pid_t, std::vector<Frame>> stacktraces) {
-    statistic_.pushFrames(concatStacktraces(std::move(stacktraces)));
-    if (++iteration_ % (sampling_ / 10) == 0) {
-        std::vector<std::string> lines;
-        for (const auto &kv: statistic_.topFrames(30)) {
-            lines.push_back(str(boost::format(
-                    "%6.2f%% %s") %
-                        (kv.first*100) %
-                        abbrev(demangle(kv.second))));
+void ProfilingTracer::handleKeys() {
+    for (int key; (key = readKey()) != -1; ) {
+        switch (key) {
+            case KEY_UP:
+            case 'k':
+                if (selected_) {
+                    --selected_;
+                }
+                break;
+            case KEY_DOWN:
+            case 'j':
+                if (selected_ + 1 < listed_.size()) {
+                    ++selected_;
+                }
+                break;
+            case '\n':
+            case KEY_ENTER:
+            case KEY_RIGHT:
+                if (selected_ < listed_.size()) {
+                    focus_.push_back(listed_[selected_].first);
+                    selected_ = 0;
+                }
+                break;
+            case KEY_BACKSPACE:
+            case 127:
+            case KEY_LEFT:
+                if (!focus_.empty()) {
+                    focus_.pop_back();
+                    selected_ = 0;
+                }
+                break;
+            case 's':
+                sortBySelf_ = !sortBySelf_;
+                break;
+            case 'p':
+                showNext(Grouping::PROCESS);
+                break;
+            case 't':
+                showNext(Grouping::THREAD);
+                break;
+            case 'c':
+                showNext(Grouping::NAME);
+                break;
         }
-        if (!infoLines_.empty()) {
+    }
+}
+
+void ProfilingTracer::render() {
+    std::vector<std::string> lines;
+    listed_.clear();
+
+    refreshThreads();
+    lines.push_back(describeShown());
+    lines.push_back("");
+
+    if (focus_.empty()) {
+        lines.push_back(str(boost::format(
+                "   SELF   TOTAL  sorted by %s, 's' to switch") %
+                    (sortBySelf_ ? "self" : "total")));
+        for (const auto& kv:
+                shownTree_->topFunctions(TOP_SIZE, sortBySelf_)) {
+            addFunctionLine(&lines,
+                    percent(kv.first.self) + " " + percent(kv.first.total),
+                    kv.second);
+        }
+    } else {
+        FunctionId function = focus_.back();
+        auto counts = shownTree_->counts(function);
+        lines.push_back(str(boost::format(
+                "%s: self %s, total %s") %
+                    symbolizer_->name(function) %
+                    percent(counts.self) %
+                    percent(counts.total)));
+        shownTree_->neighbours(function, &callers_, &callees_);
+        for (const auto& section: {
+                std::make_pair("CALLERS:", &callers_),
+                std::make_pair("CALLEES:", &callees_)}) {
             lines.push_back("");
-            lines.push_back("INFO:");
-            for (const auto& pair: infoLines_) {
-                if (pair.second > 1) {
-                    lines.push_back(str(boost::format(
-                            "%s (x %d times)") % pair.first % pair.second));
-                } else {
-                    lines.push_back(pair.first);
-                }
+            lines.push_back(section.first);
+            for (size_t i = 0;
+                    i != std::min(NEIGHBOURS_SIZE, section.second->size());
+                    ++i) {
+                const auto& kv = (*section.second)[i];
+                addFunctionLine(&lines, percent(kv.first), kv.second);
+            }
+        }
+    }
+    if (selected_ >= listed_.size()) {
+        selected_ = listed_.empty() ? 0 : listed_.size() - 1;
+    }
+
+    if (!infoLines_.empty()) {
+        lines.push_back("");
+        lines.push_back("INFO:");
+        for (const auto& pair: infoLines_) {
+            if (pair.second > 1) {
+                lines.push_back(str(boost::format(
+                        "%s (x %d times)") % pair.first % pair.second));
+            } else {
+                lines.push_back(pair.first);
             }
-            infoLines_.clear();
         }
-        putLines(lines);
+        infoLines_.clear();
     }
+    if (!status_.empty()) {
+        lines.push_back("");
+        lines.push_back("STATUS:");
+        for (const auto& pair: status_) {
+            lines.push_back(pair.first + ": " + pair.second);
+        }
+    }
+    putLines(lines, listed_.empty() ? -1 : listed_[selected_].second);
 }
 
-void ProfilingTracer::addInfoLine(const std::string& info) {
-    ++infoLines_[info];
+void ProfilingTracer::addFunctionLine(
+        std::vector<std::string>* lines,
+        const std::string& counts,
+        FunctionId function) {
+    listed_.emplace_back(function, lines->size());
+    lines->push_back(counts + " " + symbolizer_->name(function));
+}
+
+std::string ProfilingTracer::percent(uint32_t count) const {
+    return str(boost::format("%6.2f%%") %
+            (100.0 * count / std::max<size_t>(1, shownTree_->ticks())));
 }
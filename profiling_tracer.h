@@ -1,21 +1,87 @@
 #pragma once
 
-#include "running_statistic.h"
+#include "call_tree.h"
 #include "tracer.h"
 
+#include <chrono>
 #include <map>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <unistd.h>
+
+class Symbolizer;
+
+// Live top of functions by self or total time. Keys: up and down
+// select a function, Enter (or right) shows its callers and callees,
+// Backspace (or left) goes back, 's' switches sorting. 'p', 't' and 'c'
+// go through the processes, the threads and the thread names (comm)
+// one by one, showing only the samples of that one, and back to all.
 class ProfilingTracer : public Tracer{
 public:
-    explicit ProfilingTracer(int sampling);
-    void tick(std::map<pid_t, std::vector<Frame>> stacktraces) override;
+    explicit ProfilingTracer(Symbolizer* symbolizer);
+    void tick(const SampleBatch& batch) override;
     void addInfoLine(const std::string& info) override;
+    void setStatus(
+            const std::string& name, const std::string& value) override;
 
 private:
-    RunningStatistic statistic_;
+    enum class Grouping {
+        ALL,
+        PROCESS,
+        THREAD,
+        NAME,
+    };
+
+    struct Thread {
+        pid_t pid;
+        std::string name;
+        std::chrono::steady_clock::time_point lastSeen;
+    };
+
+    // Shows the group after the shown one, or the first one if another
+    // grouping is shown, or all after the last one.
+    void showNext(Grouping grouping);
+    bool isShown(pid_t tid, const Thread& thread) const;
+    // Forgets the threads not seen for a while, and reads the names
+    // of the others again.
+    void refreshThreads();
+    std::string describeShown() const;
+    void handleKeys();
+    void render();
+    // Adds a selectable line for function.
+    void addFunctionLine(
+            std::vector<std::string>* lines,
+            const std::string& counts,
+            FunctionId function);
+    std::string percent(uint32_t count) const;
+
+    Symbolizer* symbolizer_;
+    CallTree callTree_;
+    // Of the group shown alone, since it has been.
+    CallTree groupTree_;
+    SampleBatch groupBatch_;
+    Grouping grouping_;
+    // Pid or tid, or thread name, of the group shown.
+    pid_t shownId_;
+    std::string shownName_;
+    CallTree* shownTree_;
+    // Seen in samples, by tid.
+    std::unordered_map<pid_t, Thread> threads_;
+    std::chrono::steady_clock::time_point lastThreadsRefresh_;
     std::map<std::string, size_t> infoLines_;
-    int sampling_;
-    int iteration_;
+    std::map<std::string, std::string> status_;
+    std::chrono::steady_clock::time_point lastRender_;
+
+    bool sortBySelf_;
+    // Functions drilled into, the last one is shown.
+    std::vector<FunctionId> focus_;
+    // Index in listed_.
+    size_t selected_;
+    // Selectable functions on the screen and their line numbers.
+    std::vector<std::pair<FunctionId, int>> listed_;
+    std::vector<std::pair<uint32_t, FunctionId>> callers_;
+    std::vector<std::pair<uint32_t, FunctionId>> callees_;
 };
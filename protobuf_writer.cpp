@@ -0,0 +1,35 @@
+#include "protobuf_writer.h"
+#include "recording.h"
+
+namespace {
+
+const int WIRE_VARINT = 0;
+const int WIRE_LENGTH_DELIMITED = 2;
+
+} // namespace
+
+void ProtobufWriter::varint(int field, uint64_t value) {
+    key(field, WIRE_VARINT);
+    putVarint(&data_, value);
+}
+
+void ProtobufWriter::bytes(int field, const std::string& value) {
+    key(field, WIRE_LENGTH_DELIMITED);
+    putVarint(&data_, value.size());
+    data_ += value;
+}
+
+void ProtobufWriter::packed(int field, const std::vector<uint64_t>& values) {
+    if (values.empty()) {
+        return;
+    }
+    std::string payload;
+    for (uint64_t value: values) {
+        putVarint(&payload, value);
+    }
+    bytes(field, payload);
+}
+
+void ProtobufWriter::key(int field, int wireType) {
+    putVarint(&data_, static_cast<uint64_t>(field) << 3 | wireType);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Just enough of the protobuf wire format to write messages
+// without the protobuf runtime. Fields are appended in call order.
+class ProtobufWriter {
+public:
+    void varint(int field, uint64_t value);
+    void bytes(int field, const std::string& value);
+    // Nested message.
+    void message(int field, const ProtobufWriter& message) {
+        bytes(field, message.data());
+    }
+    // Packed repeated varints.
+    void packed(int field, const std::vector<uint64_t>& values);
+
+    const std::string& data() const { return data_; }
+    void clear() { data_.clear(); }
+
+private:
+    void key(int field, int wireType);
+
+    std::string data_;
+};
@@ -0,0 +1,202 @@
+#include "recording.h"
+#include "exception.h"
+#include "scope.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char RECORDING_MAGIC[8] = {'W', 'A', 'T', 'R', 'E', 'C', '2', '\0'};
+const char RECORDING_MAGIC_V1[8] = {'W', 'A', 'T', 'R', 'E', 'C', '1', '\0'};
+
+namespace {
+
+// Thrown when a record runs past the end of the file.
+class Truncated {};
+
+} // namespace
+
+void putVarint(std::string* out, uint64_t value) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+
+void putZigzag(std::string* out, int64_t value) {
+    putVarint(out, (static_cast<uint64_t>(value) << 1) ^ (value >> 63));
+}
+
+class Recording::Reader {
+public:
+    Reader(const char* begin, const char* end): p_(begin), end_(end) {}
+
+    bool atEnd() const { return p_ == end_; }
+    const char* position() const { return p_; }
+
+    uint8_t byte() {
+        if (p_ == end_) {
+            throw Truncated();
+        }
+        return *p_++;
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b = byte();
+            value |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Recording: malformed varint");
+    }
+
+    int64_t zigzag() {
+        uint64_t value = varint();
+        return (value >> 1) ^ -(value & 1);
+    }
+
+    std::string string() {
+        uint64_t length = varint();
+        if (length > static_cast<uint64_t>(end_ - p_)) {
+            throw Truncated();
+        }
+        std::string result(p_, length);
+        p_ += length;
+        return result;
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+};
+
+Recording::Recording(const std::string& path) {
+    int fd = throwErrnoIfMinus1(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    SCOPE_EXIT(close(fd));
+
+    struct stat st;
+    throwErrnoIfMinus1(fstat(fd, &st));
+    size_ = st.st_size;
+    if (size_ < sizeof(RECORDING_MAGIC)) {
+        throw std::runtime_error(path + ": not a recording");
+    }
+    void* image = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED) {
+        throwErrno();
+    }
+    size_t size = size_;
+    image_ = std::unique_ptr<void, std::function<void (void*)>>(
+            image, [=](void* image) { munmap(image, size); });
+
+    const char* base = static_cast<const char *>(image);
+    bool isV1 = !memcmp(base, RECORDING_MAGIC_V1, sizeof(RECORDING_MAGIC));
+    if (!isV1 && memcmp(base, RECORDING_MAGIC, sizeof(RECORDING_MAGIC))) {
+        throw std::runtime_error(path + ": not a recording");
+    }
+    Reader reader(base + sizeof(RECORDING_MAGIC), base + size_);
+    try {
+        pid_ = isV1 ? reader.varint() : 0;
+        sampling_ = reader.varint();
+        startTime_ = reader.varint();
+    } catch (const Truncated&) {
+        throw std::runtime_error(path + ": truncated header");
+    }
+    recordsOffset_ = reader.position() - base;
+}
+
+void Recording::replay(
+        const std::function<void (uint64_t, const SampleBatch&)>& f) {
+    const char* base = static_cast<const char *>(image_.get());
+    Reader reader(base + recordsOffset_, base + size_);
+
+    names_.clear();
+    mappings_.clear();
+    std::vector<std::vector<Frame>> stacks;
+    SampleBatch batch;
+    uint64_t time = 0;
+
+    auto checkFunction = [&](uint64_t function) {
+        if (function >= names_.size()) {
+            throw std::runtime_error("Recording: unknown function");
+        }
+        return static_cast<FunctionId>(function);
+    };
+
+    try {
+        while (!reader.atEnd()) {
+            switch (static_cast<RecordType>(reader.byte())) {
+                case RecordType::FUNCTION:
+                    {
+                        uint64_t id = reader.varint();
+                        std::string name = reader.string();
+                        if (id >= names_.size()) {
+                            names_.resize(id + 1);
+                        }
+                        names_[id] = std::move(name);
+                    }
+                    break;
+                case RecordType::MAPPINGS:
+                    {
+                        pid_t pid = pid_ ? pid_ : reader.varint();
+                        std::vector<Mapping> mappings(reader.varint());
+                        for (auto& mapping: mappings) {
+                            mapping.start = reader.varint();
+                            mapping.end = reader.varint();
+                            mapping.offset = reader.varint();
+                            mapping.inode = 0;
+                            mapping.path = reader.string();
+                        }
+                        mappings_[pid] = std::move(mappings);
+                    }
+                    break;
+                case RecordType::STACK:
+                    {
+                        std::vector<Frame> stack(reader.varint());
+                        unw_word_t ip = 0;
+                        for (auto& frame: stack) {
+                            ip += reader.zigzag();
+                            frame.ip = ip;
+                            frame.sp = 0;
+                            frame.function = checkFunction(reader.varint());
+                        }
+                        stacks.push_back(std::move(stack));
+                    }
+                    break;
+                case RecordType::TICK:
+                    {
+                        time += reader.varint();
+                        batch.clear();
+                        uint64_t samples = reader.varint();
+                        for (uint64_t i = 0; i != samples; ++i) {
+                            pid_t pid = pid_ ? pid_ : reader.varint();
+                            pid_t tid = reader.varint();
+                            uint64_t stack = reader.varint();
+                            if (stack >= stacks.size()) {
+                                throw std::runtime_error(
+                                        "Recording: unknown stack");
+                            }
+                            batch.add(pid, tid, stacks[stack]);
+                        }
+                        f(time, batch);
+                    }
+                    break;
+                default:
+                    throw std::runtime_error("Recording: unknown record");
+            }
+        }
+    } catch (const Truncated&) {
+        // The recorder has been killed, everything before is fine.
+    }
+}
+
+const std::string& Recording::name(FunctionId function) const {
+    static const std::string unknown = "{unknown}";
+    return function < names_.size() ? names_[function] : unknown;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "frame.h"
+#include "mappings.h"
+#include "sample_batch.h"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Binary recording of samples, written by RecordingTracer and read
+// back by `wat report`. All integers are LEB128 varints.
+//
+// The file starts with RECORDING_MAGIC and a header: sampling frequency
+// and start time in microseconds since the epoch. Records follow, each
+// starting with a type byte:
+//   FUNCTION  id, name length, name.
+//   MAPPINGS  pid, count, then start, end, offset, path length and path
+//             of each mapping. Replaces the mappings of the process
+//             recorded before.
+//   STACK     defines the next stack id, counting from 0: frame count,
+//             then for each frame from the innermost, the ip as a
+//             zigzag delta from the previous frame's ip (from 0 for
+//             the first one) and the function id.
+//   TICK      microseconds since the previous tick (or the start),
+//             sample count, then process id, thread id and stack id
+//             of each sample.
+// Functions and stacks are recorded before the first record using them.
+// A recording cut short is read up to its last complete record.
+//
+// Recordings of a single process starting with RECORDING_MAGIC_V1 are
+// read too: their header starts with the pid, which MAPPINGS and TICK
+// records leave out.
+
+extern const char RECORDING_MAGIC[8];
+extern const char RECORDING_MAGIC_V1[8];
+
+enum class RecordType : uint8_t {
+    FUNCTION = 1,
+    MAPPINGS = 2,
+    STACK = 3,
+    TICK = 4,
+};
+
+void putVarint(std::string* out, uint64_t value);
+void putZigzag(std::string* out, int64_t value);
+
+class Recording {
+public:
+    // Maps the file. Throws if it is not a recording.
+    explicit Recording(const std::string& path);
+
+    int sampling() const { return sampling_; }
+    uint64_t startTime() const { return startTime_; }
+
+    // Decodes the records in order, passing every tick to f with its
+    // time in microseconds since the start. Functions and mappings
+    // below are complete after that.
+    void replay(
+            const std::function<void (uint64_t, const SampleBatch&)>& f);
+
+    const std::string& name(FunctionId function) const;
+    // Last recorded ones of every process.
+    const std::map<pid_t, std::vector<Mapping>>& mappings() const {
+        return mappings_;
+    }
+
+private:
+    class Reader;
+
+    std::unique_ptr<void, std::function<void (void*)>> image_;
+    size_t size_;
+    // Offset of the first record.
+    size_t recordsOffset_;
+
+    // Of the only process in a version 1 recording, 0 otherwise.
+    pid_t pid_;
+    int sampling_;
+    uint64_t startTime_;
+
+    std::vector<std::string> names_;
+    std::map<pid_t, std::vector<Mapping>> mappings_;
+};
@@ -0,0 +1,156 @@
+#include "recording_tracer.h"
+#include "exception.h"
+#include "recording.h"
+#include "symbolizer.h"
+
+#include <sys/time.h>
+
+RecordingTracer::RecordingTracer(
+        const std::string& path,
+        int sampling,
+        Symbolizer* symbolizer) :
+    sampling_(sampling),
+    symbolizer_(symbolizer),
+    file_(fopen(path.c_str(), "w"), &fclose),
+    lastTick_(std::chrono::steady_clock::now()),
+    lastMappingsCheck_(lastTick_),
+    nextStackId_(0)
+{
+    if (!file_) {
+        throwErrno();
+    }
+
+    struct timeval tv;
+    throwErrnoIfMinus1(gettimeofday(&tv, nullptr));
+    buffer_.append(RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+    putVarint(&buffer_, sampling_);
+    putVarint(&buffer_,
+            static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec);
+    write();
+}
+
+RecordingTracer::~RecordingTracer() {
+    fflush(file_.get());
+}
+
+void RecordingTracer::tick(const SampleBatch& batch) {
+    // Mappings are only needed to tell where functions come from,
+    // so checking them once a second is plenty.
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastMappingsCheck_ >= std::chrono::seconds(1)) {
+        lastMappingsCheck_ = now;
+        for (auto iter = mappings_.begin(); iter != mappings_.end(); ) {
+            if (recordMappings(iter->first)) {
+                ++iter;
+            } else {
+                iter = mappings_.erase(iter);
+            }
+        }
+    }
+
+    stackIds_.clear();
+    for (size_t i = 0; i != batch.size(); ++i) {
+        pid_t pid = batch[i].pid();
+        if (!mappings_.count(pid) && !recordMappings(pid)) {
+            // Not to be looked up again until the next refresh.
+            mappings_[pid];
+        }
+        stackIds_.push_back(stackId(batch[i]));
+    }
+
+    buffer_.push_back(static_cast<char>(RecordType::TICK));
+    putVarint(&buffer_, std::chrono::duration_cast<std::chrono::microseconds>(
+                now - lastTick_).count());
+    lastTick_ = now;
+    putVarint(&buffer_, batch.size());
+    for (size_t i = 0; i != batch.size(); ++i) {
+        putVarint(&buffer_, batch[i].pid());
+        putVarint(&buffer_, batch[i].tid());
+        putVarint(&buffer_, stackIds_[i]);
+    }
+    write();
+}
+
+uint32_t RecordingTracer::stackId(const SampleBatch::Stacktrace& stacktrace) {
+    ips_.clear();
+    ips_.push_back(stacktrace.pid());
+    for (const auto& frame: stacktrace) {
+        ips_.push_back(frame.ip);
+    }
+    auto iter = stacks_.find(ips_);
+    if (iter != stacks_.end()) {
+        return iter->second;
+    }
+
+    for (const auto& frame: stacktrace) {
+        if (frame.function >= isFunctionRecorded_.size()) {
+            isFunctionRecorded_.resize(frame.function + 1);
+        }
+        if (isFunctionRecorded_[frame.function]) {
+            continue;
+        }
+        isFunctionRecorded_[frame.function] = true;
+        const auto& name = symbolizer_->name(frame.function);
+        buffer_.push_back(static_cast<char>(RecordType::FUNCTION));
+        putVarint(&buffer_, frame.function);
+        putVarint(&buffer_, name.size());
+        buffer_ += name;
+    }
+
+    buffer_.push_back(static_cast<char>(RecordType::STACK));
+    putVarint(&buffer_, stacktrace.size());
+    unw_word_t ip = 0;
+    for (const auto& frame: stacktrace) {
+        putZigzag(&buffer_, frame.ip - ip);
+        ip = frame.ip;
+        putVarint(&buffer_, frame.function);
+    }
+
+    stacks_.emplace(ips_, nextStackId_);
+    return nextStackId_++;
+}
+
+bool RecordingTracer::recordMappings(pid_t pid) {
+    auto mappings = readExecutableMappings(pid);
+    if (mappings.empty()) {
+        // Gone, its samples are over.
+        return false;
+    }
+    auto& recorded = mappings_[pid];
+    if (mappings == recorded) {
+        return true;
+    }
+    recorded = std::move(mappings);
+    // The same ips may belong to other functions now.
+    stacks_.clear();
+    buffer_.push_back(static_cast<char>(RecordType::MAPPINGS));
+    putVarint(&buffer_, pid);
+    putVarint(&buffer_, recorded.size());
+    for (const auto& mapping: recorded) {
+        putVarint(&buffer_, mapping.start);
+        putVarint(&buffer_, mapping.end);
+        putVarint(&buffer_, mapping.offset);
+        putVarint(&buffer_, mapping.path.size());
+        buffer_ += mapping.path;
+    }
+    return true;
+}
+
+void RecordingTracer::write() {
+    // Buffered by stdio, so it only gets to the file in big chunks.
+    if (fwrite(buffer_.data(), 1, buffer_.size(), file_.get()) !=
+            buffer_.size()) {
+        throwErrno();
+    }
+    buffer_.clear();
+}
+
+size_t RecordingTracer::StackHash::operator()(
+        const std::vector<unw_word_t>& ips) const {
+    // FNV-1a over the ips.
+    uint64_t hash = 14695981039346656037ull;
+    for (unw_word_t ip: ips) {
+        hash = (hash ^ ip) * 1099511628211ull;
+    }
+    return hash;
+}
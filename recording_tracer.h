@@ -0,0 +1,60 @@
+#pragma once
+
+#include "mappings.h"
+#include "tracer.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+class Symbolizer;
+
+// Appends every tick to a binary recording (see recording.h), which can
+// be analysed later with `wat report`. Each distinct stack is written
+// once, and ticks refer to stacks by id.
+class RecordingTracer : public Tracer {
+public:
+    RecordingTracer(
+            const std::string& path,
+            int sampling,
+            Symbolizer* symbolizer);
+    ~RecordingTracer();
+
+    void tick(const SampleBatch& batch) override;
+    void addInfoLine(const std::string& /* info */) override {}
+
+private:
+    struct StackHash {
+        size_t operator()(const std::vector<unw_word_t>& ips) const;
+    };
+
+    uint32_t stackId(const SampleBatch::Stacktrace& stacktrace);
+    // Returns false if the process is gone.
+    bool recordMappings(pid_t pid);
+    void write();
+
+    int sampling_;
+    Symbolizer* symbolizer_;
+    std::unique_ptr<FILE, int (*)(FILE*)> file_;
+    std::chrono::steady_clock::time_point lastTick_;
+    std::chrono::steady_clock::time_point lastMappingsCheck_;
+
+    // Keyed by the pid followed by the ips.
+    std::unordered_map<std::vector<unw_word_t>, uint32_t, StackHash> stacks_;
+    uint32_t nextStackId_;
+    // Indexed by FunctionId.
+    std::vector<bool> isFunctionRecorded_;
+    // Of the processes seen in samples, as last recorded.
+    std::map<pid_t, std::vector<Mapping>> mappings_;
+
+    std::vector<unw_word_t> ips_;
+    std::vector<uint32_t> stackIds_;
+    std::string buffer_;
+};
@@ -0,0 +1,196 @@
+#include "report.h"
+#include "call_tree.h"
+#include "recording.h"
+
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <errno.h>
+#include <getopt.h>
+
+namespace {
+
+void usage() {
+    std::cerr << boost::format(
+            "Usage: %s report [-n count] [-m percent] file\n"
+            "  -n  show that many top functions (default: 30)\n"
+            "  -m  hide call tree nodes below that total percentage\n"
+            "      (default: 1)\n") %
+        program_invocation_short_name;
+}
+
+struct ThreadStats {
+    pid_t pid = 0;
+    uint64_t samples = 0;
+    // Samples ending in the function.
+    std::map<FunctionId, uint64_t> self;
+};
+
+class Report {
+public:
+    Report(const Recording& recording, size_t ticks) :
+        recording_(recording), ticks_(std::max<size_t>(1, ticks))
+    {}
+
+    std::string percent(uint64_t count) const {
+        return str(boost::format("%6.2f%%") % (100.0 * count / ticks_));
+    }
+
+    void printCallTree(const CallTree& tree, double minPercent) {
+        const auto& nodes = tree.nodes();
+        children_.assign(nodes.size(), {});
+        for (uint32_t node = 1; node != nodes.size(); ++node) {
+            if (100.0 * nodes[node].counts.total / ticks_ >= minPercent) {
+                children_[nodes[node].parent].push_back(node);
+            }
+        }
+        for (auto& children: children_) {
+            std::sort(children.begin(), children.end(),
+                    [&](uint32_t a, uint32_t b) {
+                        return nodes[a].counts.total > nodes[b].counts.total;
+                    });
+        }
+        printSubtree(nodes, 0, 0);
+    }
+
+private:
+    void printSubtree(
+            const std::vector<CallTree::Node>& nodes,
+            uint32_t node,
+            size_t depth) {
+        for (uint32_t child: children_[node]) {
+            std::cout << boost::format("%s %s %s%s\n") %
+                percent(nodes[child].counts.total) %
+                percent(nodes[child].counts.self) %
+                std::string(depth * 2, ' ') %
+                recording_.name(nodes[child].function);
+            printSubtree(nodes, child, depth + 1);
+        }
+    }
+
+    const Recording& recording_;
+    size_t ticks_;
+    std::vector<std::vector<uint32_t>> children_;
+};
+
+} // namespace
+
+int report(int argc, char* argv[]) {
+    size_t topSize = 30;
+    double minPercent = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+        switch (opt) {
+            case 'n':
+                topSize = boost::lexical_cast<size_t>(optarg);
+                break;
+            case 'm':
+                minPercent = boost::lexical_cast<double>(optarg);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage();
+        return 1;
+    }
+
+    Recording recording(argv[optind]);
+    CallTree tree;
+    uint64_t duration = 0;
+    std::map<pid_t, ThreadStats> threads;
+    std::map<pid_t, uint64_t> processes;
+    uint64_t samples = 0;
+    recording.replay([&](uint64_t time, const SampleBatch& batch) {
+        duration = time;
+        tree.push(batch);
+        for (size_t i = 0; i != batch.size(); ++i) {
+            ++processes[batch[i].pid()];
+            auto& thread = threads[batch[i].tid()];
+            thread.pid = batch[i].pid();
+            ++thread.samples;
+            if (batch[i].size()) {
+                ++thread.self[batch[i].begin()->function];
+            }
+        }
+        samples += batch.size();
+    });
+
+    size_t ticks = tree.ticks();
+    Report report(recording, ticks);
+    size_t mappings = 0;
+    for (const auto& kv: recording.mappings()) {
+        mappings += kv.second.size();
+    }
+    std::cout << boost::format(
+            "Recording of %s at %d Hz: %.1f s, %d ticks, %d samples, "
+            "%d mappings\n") %
+        (processes.size() == 1 ?
+            str(boost::format("pid %d") % processes.begin()->first) :
+            str(boost::format("%d processes") % processes.size())) %
+        recording.sampling() %
+        (duration / 1e6) %
+        ticks %
+        samples %
+        mappings;
+
+    if (processes.size() > 1) {
+        std::cout << "\nPROCESSES:\n";
+        std::vector<std::pair<uint64_t, pid_t>> bySamples;
+        for (const auto& kv: processes) {
+            bySamples.emplace_back(kv.second, kv.first);
+        }
+        std::sort(bySamples.rbegin(), bySamples.rend());
+        for (const auto& process: bySamples) {
+            std::cout << boost::format("%s pid %d\n") %
+                report.percent(process.first) % process.second;
+        }
+    }
+
+    std::cout << "\nTOP FUNCTIONS:\n   SELF   TOTAL\n";
+    for (const auto& kv: tree.topFunctions(topSize, true)) {
+        std::cout << boost::format("%s %s %s\n") %
+            report.percent(kv.first.self) %
+            report.percent(kv.first.total) %
+            recording.name(kv.second);
+    }
+
+    std::cout << "\nTHREADS:\n";
+    std::vector<std::pair<uint64_t, pid_t>> bySamples;
+    for (const auto& kv: threads) {
+        bySamples.emplace_back(kv.second.samples, kv.first);
+    }
+    std::sort(bySamples.rbegin(), bySamples.rend());
+    for (const auto& thread: bySamples) {
+        if (processes.size() > 1) {
+            std::cout << boost::format("%s thread %d of pid %d\n") %
+                report.percent(thread.first) %
+                thread.second %
+                threads[thread.second].pid;
+        } else {
+            std::cout << boost::format("%s thread %d\n") %
+                report.percent(thread.first) % thread.second;
+        }
+        std::vector<std::pair<uint64_t, FunctionId>> self;
+        for (const auto& kv: threads[thread.second].self) {
+            self.emplace_back(kv.second, kv.first);
+        }
+        std::sort(self.rbegin(), self.rend());
+        self.resize(std::min<size_t>(self.size(), 5));
+        for (const auto& kv: self) {
+            std::cout << boost::format("    %s %s\n") %
+                report.percent(kv.first) % recording.name(kv.second);
+        }
+    }
+
+    std::cout << "\nCALL TREE:\n  TOTAL    SELF\n";
+    report.printCallTree(tree, minPercent);
+    return 0;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// `wat report`: prints the top functions, threads and the call tree
+// of a recording made with -r.
+int report(int argc, char* argv[]);
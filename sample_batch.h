@@ -0,0 +1,78 @@
+#pragma once
+
+#include "frame.h"
+
+#include <cstdint>
+#include <vector>
+
+#include <unistd.h>
+
+// Stacktraces of threads sampled at once, at most one per thread.
+// Everything is kept in flat arrays which keep their capacity when
+// the batch is cleared, so a batch reused from tick to tick stops
+// allocating once it has seen the largest tick.
+class SampleBatch {
+public:
+    class Stacktrace {
+    public:
+        Stacktrace(
+                pid_t pid, pid_t tid, const Frame* begin, const Frame* end) :
+            pid_(pid), tid_(tid), begin_(begin), end_(end)
+        {}
+
+        // Process the thread belongs to.
+        pid_t pid() const { return pid_; }
+        pid_t tid() const { return tid_; }
+        const Frame* begin() const { return begin_; }
+        const Frame* end() const { return end_; }
+        size_t size() const { return end_ - begin_; }
+
+    private:
+        pid_t pid_;
+        pid_t tid_;
+        const Frame* begin_;
+        const Frame* end_;
+    };
+
+    SampleBatch(): offsets_(1, 0) {}
+
+    void clear() {
+        pids_.clear();
+        tids_.clear();
+        offsets_.resize(1);
+        frames_.clear();
+    }
+
+    void add(pid_t pid, pid_t tid, const std::vector<Frame>& stacktrace) {
+        pids_.push_back(pid);
+        tids_.push_back(tid);
+        frames_.insert(frames_.end(), stacktrace.begin(), stacktrace.end());
+        offsets_.push_back(frames_.size());
+    }
+
+    // Copies a stacktrace of another batch.
+    void add(const Stacktrace& stacktrace) {
+        pids_.push_back(stacktrace.pid());
+        tids_.push_back(stacktrace.tid());
+        frames_.insert(frames_.end(), stacktrace.begin(), stacktrace.end());
+        offsets_.push_back(frames_.size());
+    }
+
+    size_t size() const { return tids_.size(); }
+    bool empty() const { return tids_.empty(); }
+
+    Stacktrace operator[](size_t i) const {
+        return Stacktrace(
+                pids_[i],
+                tids_[i],
+                frames_.data() + offsets_[i],
+                frames_.data() + offsets_[i + 1]);
+    }
+
+private:
+    std::vector<pid_t> pids_;
+    std::vector<pid_t> tids_;
+    // Stacktrace i is frames_[offsets_[i], offsets_[i + 1]).
+    std::vector<uint32_t> offsets_;
+    std::vector<Frame> frames_;
+};
@@ -2,9 +2,6 @@
 
 #include <initializer_list>
 
-void handleSignals(
-        std::initializer_list<int> handle,
-        std::initializer_list<int> block);
-
-int lastSignal();
-void resetLastSignal();
+// Blocks the signals in the calling thread, and the threads it creates
+// from now on. They are to be received with signalfd.
+void blockSignals(std::initializer_list<int> signals);
@@ -0,0 +1,199 @@
+#include "snapshot.h"
+#include "scope.h"
+
+#include <cstddef>
+#include <cstring>
+
+#include <libunwind-ptrace.h>
+
+#include <sys/uio.h>
+
+namespace {
+
+const unw_word_t PAGE_BYTES = 4096;
+// Leaf functions are allowed to use that much below the stack pointer.
+const unw_word_t RED_ZONE = 128;
+
+unw_word_t pageOf(unw_word_t addr) {
+    return addr & ~(PAGE_BYTES - 1);
+}
+
+// Returns number of bytes actually read. The read stops at the
+// first unmapped page.
+size_t readRemote(pid_t tid, unw_word_t addr, char* buf, size_t size) {
+    // process_vm_readv reports partial transfers with
+    // granularity of iovec elements, so split the range into pages.
+    std::vector<iovec> remote;
+    for (unw_word_t p = addr; p < addr + size; p = pageOf(p) + PAGE_BYTES) {
+        size_t len = std::min(pageOf(p) + PAGE_BYTES, addr + size) - p;
+        remote.push_back({reinterpret_cast<void *>(p), len});
+    }
+    iovec local{buf, size};
+    ssize_t ret = process_vm_readv(
+            tid, &local, 1, remote.data(), remote.size(), 0);
+    return ret < 0 ? 0 : ret;
+}
+
+int regOffset(unw_regnum_t reg) {
+    switch (reg) {
+        case UNW_X86_64_RAX: return offsetof(user_regs_struct, rax);
+        case UNW_X86_64_RDX: return offsetof(user_regs_struct, rdx);
+        case UNW_X86_64_RCX: return offsetof(user_regs_struct, rcx);
+        case UNW_X86_64_RBX: return offsetof(user_regs_struct, rbx);
+        case UNW_X86_64_RSI: return offsetof(user_regs_struct, rsi);
+        case UNW_X86_64_RDI: return offsetof(user_regs_struct, rdi);
+        case UNW_X86_64_RBP: return offsetof(user_regs_struct, rbp);
+        case UNW_X86_64_RSP: return offsetof(user_regs_struct, rsp);
+        case UNW_X86_64_R8: return offsetof(user_regs_struct, r8);
+        case UNW_X86_64_R9: return offsetof(user_regs_struct, r9);
+        case UNW_X86_64_R10: return offsetof(user_regs_struct, r10);
+        case UNW_X86_64_R11: return offsetof(user_regs_struct, r11);
+        case UNW_X86_64_R12: return offsetof(user_regs_struct, r12);
+        case UNW_X86_64_R13: return offsetof(user_regs_struct, r13);
+        case UNW_X86_64_R14: return offsetof(user_regs_struct, r14);
+        case UNW_X86_64_R15: return offsetof(user_regs_struct, r15);
+        case UNW_X86_64_RIP: return offsetof(user_regs_struct, rip);
+        default: return -1;
+    }
+}
+
+// Unwind info being looked up with _UPT_ functions on this thread.
+// They pass their own arg, the upt, on to the accessors below, which
+// still have to read memory from the snapshot.
+thread_local SnapshotUnwindInfo* uptCaller = nullptr;
+
+SnapshotUnwindInfo* info(void* arg) {
+    if (uptCaller && arg == uptCaller->upt()) {
+        return uptCaller;
+    }
+    return static_cast<SnapshotUnwindInfo *>(arg);
+}
+
+// Calls f with the upt of the unwind info behind arg.
+template <class F>
+auto callUpt(void* arg, F f) {
+    SnapshotUnwindInfo* previous = uptCaller;
+    uptCaller = info(arg);
+    SCOPE_EXIT(uptCaller = previous);
+    return f(uptCaller->upt());
+}
+
+int findProcInfo(
+        unw_addr_space_t as, unw_word_t ip, unw_proc_info_t* pi,
+        int needUnwindInfo, void* arg) {
+    return callUpt(arg, [&](void* upt) {
+        return _UPT_find_proc_info(as, ip, pi, needUnwindInfo, upt);
+    });
+}
+
+void putUnwindInfo(unw_addr_space_t as, unw_proc_info_t* pi, void* arg) {
+    callUpt(arg, [&](void* upt) {
+        _UPT_put_unwind_info(as, pi, upt);
+    });
+}
+
+int getDynInfoListAddr(
+        unw_addr_space_t as, unw_word_t* dilap, void* arg) {
+    return callUpt(arg, [&](void* upt) {
+        return _UPT_get_dyn_info_list_addr(as, dilap, upt);
+    });
+}
+
+int accessMem(
+        unw_addr_space_t, unw_word_t addr, unw_word_t* val,
+        int write, void* arg) {
+    if (write) {
+        return -UNW_EINVAL;
+    }
+    return info(arg)->readWord(addr, val) ? 0 : -UNW_EINVAL;
+}
+
+int accessReg(
+        unw_addr_space_t, unw_regnum_t reg, unw_word_t* val,
+        int write, void* arg) {
+    int offset = regOffset(reg);
+    if (offset < 0) {
+        return -UNW_EBADREG;
+    }
+    if (write) {
+        return -UNW_EREADONLYREG;
+    }
+    memcpy(val,
+            reinterpret_cast<const char *>(&info(arg)->snapshot().regs) +
+                offset,
+            sizeof(*val));
+    return 0;
+}
+
+int accessFpreg(
+        unw_addr_space_t, unw_regnum_t, unw_fpreg_t*, int, void*) {
+    return -UNW_EBADREG;
+}
+
+int resume(unw_addr_space_t, unw_cursor_t*, void*) {
+    return -UNW_EINVAL;
+}
+
+int getProcName(
+        unw_addr_space_t as, unw_word_t ip, char* buf, size_t len,
+        unw_word_t* offp, void* arg) {
+    return callUpt(arg, [&](void* upt) {
+        return _UPT_get_proc_name(as, ip, buf, len, offp, upt);
+    });
+}
+
+} // namespace
+
+void readStack(StackSnapshot* snapshot, size_t stackSize) {
+    snapshot->stackStart = snapshot->regs.rsp - RED_ZONE;
+    snapshot->stack.resize(stackSize + RED_ZONE);
+    snapshot->stack.resize(readRemote(
+                snapshot->tid,
+                snapshot->stackStart,
+                snapshot->stack.data(),
+                snapshot->stack.size()));
+}
+
+bool SnapshotUnwindInfo::readWord(unw_word_t addr, unw_word_t* value) {
+    const auto& stack = snapshot_.stack;
+    if (addr >= snapshot_.stackStart &&
+            addr + sizeof(*value) <= snapshot_.stackStart + stack.size()) {
+        memcpy(value,
+                stack.data() + (addr - snapshot_.stackStart),
+                sizeof(*value));
+        return true;
+    }
+
+    unw_word_t page = pageOf(addr);
+    if (pageOf(addr + sizeof(*value) - 1) != page) {
+        // Unaligned read crossing page boundary, don't bother caching it.
+        return readRemote(
+                snapshot_.tid, addr, reinterpret_cast<char *>(value),
+                sizeof(*value)) == sizeof(*value);
+    }
+    auto iter = pages_.find(page);
+    if (iter == pages_.end()) {
+        std::vector<char> data(PAGE_BYTES);
+        data.resize(readRemote(snapshot_.tid, page, data.data(), PAGE_BYTES));
+        iter = pages_.emplace(page, std::move(data)).first;
+    }
+    if (iter->second.size() < addr - page + sizeof(*value)) {
+        return false;
+    }
+    memcpy(value, iter->second.data() + (addr - page), sizeof(*value));
+    return true;
+}
+
+unw_accessors_t* snapshotAccessors() {
+    static unw_accessors_t accessors = {
+        &findProcInfo,
+        &putUnwindInfo,
+        &getDynInfoListAddr,
+        &accessMem,
+        &accessReg,
+        &accessFpreg,
+        &resume,
+        &getProcName,
+    };
+    return &accessors;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <libunwind.h>
+
+#include <map>
+#include <vector>
+
+#include <sys/user.h>
+#include <unistd.h>
+
+// Registers and the top of the stack of a stopped thread. Once the
+// snapshot is taken, the thread may be resumed and unwound later.
+struct StackSnapshot {
+    pid_t tid;
+    user_regs_struct regs;
+    unw_word_t stackStart;
+    std::vector<char> stack;
+};
+
+// Copies up to stackSize bytes starting at the stack pointer from
+// snapshot->regs with a single process_vm_readv call.
+void readStack(StackSnapshot* snapshot, size_t stackSize);
+
+// Argument for unw_init_remote() in an address space created with
+// snapshotAccessors(). Registers and stack come from the snapshot,
+// the rest of the memory is read from the live process (that is mostly
+// code and unwind tables, which do not change under our feet).
+// Unwind tables are located with help of libunwind-ptrace info upt.
+class SnapshotUnwindInfo {
+public:
+    SnapshotUnwindInfo(const StackSnapshot& snapshot, void* upt) :
+        snapshot_(snapshot), upt_(upt)
+    {}
+
+    const StackSnapshot& snapshot() const { return snapshot_; }
+    void* upt() const { return upt_; }
+
+    bool readWord(unw_word_t addr, unw_word_t* value);
+
+private:
+    const StackSnapshot& snapshot_;
+    void* upt_;
+    // Pages read from the live process during this unwind.
+    std::map<unw_word_t, std::vector<char>> pages_;
+};
+
+unw_accessors_t* snapshotAccessors();
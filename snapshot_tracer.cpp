@@ -0,0 +1,219 @@
+#include "snapshot_tracer.h"
+#include "exception.h"
+#include "symbolizer.h"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// Listed in the top and JSON files.
+const size_t FILE_FUNCTIONS = 100;
+
+const char* extension(SnapshotFormat format) {
+    switch (format) {
+        case SnapshotFormat::TOP:
+            return ".txt";
+        case SnapshotFormat::FOLDED:
+            return ".folded";
+        case SnapshotFormat::JSON:
+            return ".json";
+    }
+    return "";
+}
+
+void putJsonString(std::string* out, const std::string& value) {
+    out->push_back('"');
+    for (char c: value) {
+        if (c == '"' || c == '\\') {
+            out->push_back('\\');
+            out->push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            *out += str(boost::format("\\u%04x") % static_cast<int>(c));
+        } else {
+            out->push_back(c);
+        }
+    }
+    out->push_back('"');
+}
+
+} // namespace
+
+SnapshotTracer::SnapshotTracer(
+        const std::string& prefix,
+        SnapshotFormat format,
+        int seconds,
+        int files,
+        Symbolizer* symbolizer) :
+    prefix_(prefix),
+    format_(format),
+    interval_(seconds),
+    files_(files),
+    symbolizer_(symbolizer),
+    snapshots_(0),
+    window_(interval_),
+    lastWrite_(std::chrono::steady_clock::now())
+{}
+
+void SnapshotTracer::tick(const SampleBatch& batch) {
+    bool isDue = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        window_.push(batch);
+        // By time rather than ticks, the sampling rate may vary.
+        auto now = std::chrono::steady_clock::now();
+        if (!prefix_.empty() && now - lastWrite_ >= interval_) {
+            lastWrite_ = now;
+            isDue = true;
+        }
+    }
+    if (isDue) {
+        write();
+    }
+}
+
+std::string SnapshotTracer::snapshot(SnapshotFormat format, size_t count) {
+    Window window;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        window = copyWindow(format, count);
+    }
+    return this->format(window, format);
+}
+
+std::string SnapshotTracer::dump() {
+    if (prefix_.empty()) {
+        throw std::runtime_error("No snapshot prefix to dump to");
+    }
+    return write();
+}
+
+SnapshotTracer::Window SnapshotTracer::copyWindow(
+        SnapshotFormat format, size_t count) {
+    Window window;
+    window.ticks = window_.ticks();
+    if (format != SnapshotFormat::FOLDED) {
+        window.functions = window_.topFunctions(count, false);
+    }
+    if (format != SnapshotFormat::TOP) {
+        window.nodes = window_.nodes();
+    }
+    return window;
+}
+
+std::string SnapshotTracer::format(
+        const Window& window, SnapshotFormat format) {
+    size_t ticks = std::max<size_t>(1, window.ticks);
+    std::string out;
+    if (format == SnapshotFormat::JSON) {
+        out += str(boost::format("{\"time\": %d, \"ticks\": %d, "
+                    "\"functions\": [") % time(nullptr) % window.ticks);
+    } else if (format == SnapshotFormat::TOP) {
+        char now[32];
+        time_t t = time(nullptr);
+        struct tm tm;
+        strftime(now, sizeof(now), "%F %T", localtime_r(&t, &tm));
+        out += str(boost::format("%s, %d ticks\n   SELF   TOTAL\n") %
+                now % window.ticks);
+    }
+
+    if (format != SnapshotFormat::FOLDED) {
+        bool isFirst = true;
+        for (const auto& kv: window.functions) {
+            const auto& name = symbolizer_->name(kv.second);
+            if (format == SnapshotFormat::TOP) {
+                out += str(boost::format("%6.2f%% %6.2f%% %s\n") %
+                        (100.0 * kv.first.self / ticks) %
+                        (100.0 * kv.first.total / ticks) %
+                        name);
+                continue;
+            }
+            out += isFirst ? "\n" : ",\n";
+            isFirst = false;
+            out += "  {\"name\": ";
+            putJsonString(&out, name);
+            out += str(boost::format(", \"self\": %d, \"total\": %d}") %
+                    kv.first.self % kv.first.total);
+        }
+        if (format == SnapshotFormat::TOP) {
+            return out;
+        }
+        out += "],\n\"stacks\": [";
+    }
+
+    // Every node samples end in is a stack, outermost function first.
+    const auto& nodes = window.nodes;
+    std::vector<FunctionId> stack;
+    std::string line;
+    bool isFirst = true;
+    for (size_t i = 1; i != nodes.size(); ++i) {
+        if (!nodes[i].counts.self) {
+            continue;
+        }
+        stack.clear();
+        for (uint32_t node = i; node; node = nodes[node].parent) {
+            stack.push_back(nodes[node].function);
+        }
+        line.clear();
+        if (format == SnapshotFormat::JSON) {
+            line += isFirst ? "\n  {\"frames\": [" : ",\n  {\"frames\": [";
+        }
+        isFirst = false;
+        for (auto iter = stack.rbegin(); iter != stack.rend(); ++iter) {
+            const auto& name = symbolizer_->name(*iter);
+            if (format == SnapshotFormat::JSON) {
+                if (iter != stack.rbegin()) {
+                    line += ", ";
+                }
+                putJsonString(&line, name);
+                continue;
+            }
+            if (iter != stack.rbegin()) {
+                line.push_back(';');
+            }
+            // Semicolons separate frames.
+            size_t begin = line.size();
+            line += name;
+            std::replace(line.begin() + begin, line.end(), ';', ':');
+        }
+        out += line;
+        out += str(boost::format(format == SnapshotFormat::JSON ?
+                    "], \"count\": %d}" : " %d\n") % nodes[i].counts.self);
+    }
+    if (format == SnapshotFormat::JSON) {
+        out += "]}\n";
+    }
+    return out;
+}
+
+std::string SnapshotTracer::write() {
+    std::unique_lock<std::mutex> fileLock(fileMutex_);
+    Window window;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        window = copyWindow(format_, FILE_FUNCTIONS);
+    }
+    auto path = str(boost::format("%s.%d%s") %
+            prefix_ % (snapshots_++ % files_) % extension(format_));
+    auto temporary = path + ".tmp";
+    auto content = format(window, format_);
+    {
+        std::unique_ptr<FILE, int (*)(FILE*)> file(
+                fopen(temporary.c_str(), "w"), &fclose);
+        if (!file) {
+            throwErrno();
+        }
+        if (fwrite(content.data(), 1, content.size(), file.get()) !=
+                content.size() || fflush(file.get())) {
+            throwErrno();
+        }
+    }
+    throwErrnoIfMinus1(rename(temporary.c_str(), path.c_str()));
+    return path;
+}
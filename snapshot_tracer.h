@@ -0,0 +1,76 @@
+#pragma once
+
+#include "call_tree.h"
+#include "tracer.h"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Symbolizer;
+
+enum class SnapshotFormat {
+    // Functions by total time, as in the live top.
+    TOP,
+    // Collapsed stacks, as written by FoldedTracer.
+    FOLDED,
+    // Both of the above in a single object.
+    JSON,
+};
+
+// Keeps the samples of the last seconds, which can be formatted at any
+// time from any thread. With a prefix, also writes them every seconds
+// to prefix.N.txt (.folded or .json), N going round from 0 to files - 1
+// so that only the newest files are kept. Each file is written under
+// another name and renamed into place, readers never see half of it.
+// The window is only locked to copy it out, formatting and writing go
+// without holding up ticks or other readers.
+class SnapshotTracer : public Tracer {
+public:
+    SnapshotTracer(
+            const std::string& prefix,
+            SnapshotFormat format,
+            int seconds,
+            int files,
+            Symbolizer* symbolizer);
+
+    void tick(const SampleBatch& batch) override;
+    void addInfoLine(const std::string& /* info */) override {}
+
+    // TOP and JSON list up to count functions.
+    std::string snapshot(SnapshotFormat format, size_t count);
+    // Writes the next file right away, returns its path. Throws without
+    // a prefix.
+    std::string dump();
+
+private:
+    // What a format needs of window_.
+    struct Window {
+        size_t ticks;
+        std::vector<std::pair<CallTree::Counts, FunctionId>> functions;
+        std::vector<CallTree::Node> nodes;
+    };
+
+    // Under mutex_.
+    Window copyWindow(SnapshotFormat format, size_t count);
+    std::string format(const Window& window, SnapshotFormat format);
+    // Writes a copy of the window to the next file.
+    std::string write();
+
+    std::string prefix_;
+    SnapshotFormat format_;
+    std::chrono::seconds interval_;
+    int files_;
+    Symbolizer* symbolizer_;
+
+    // Held over copying the window and writing it, so that no file gets
+    // an older window than the one written before.
+    std::mutex fileMutex_;
+    int snapshots_;
+
+    std::mutex mutex_;
+    CallTree window_;
+    std::chrono::steady_clock::time_point lastWrite_;
+};
@@ -0,0 +1,226 @@
+#include "symbolizer.h"
+#include "symbols.h"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <mutex>
+#include <set>
+
+#include <sys/stat.h>
+
+namespace {
+
+// The cache of a process is simply dropped once it grows that large.
+const size_t MAX_RANGES = 1 << 16;
+// Addresses outside of known mappings cause rereading the mappings,
+// but not more often than that.
+const std::chrono::seconds MIN_UPDATE_INTERVAL(1);
+
+std::unique_ptr<ElfSymbols> loadSymbols(pid_t pid, const Mapping& mapping) {
+    // Pseudo files like [vdso] can't be opened by name.
+    if (mapping.path.empty() || mapping.path[0] != '/') {
+        return nullptr;
+    }
+    auto path = str(boost::format("/proc/%d/root%s") % pid % mapping.path);
+    struct stat st;
+    if (stat(path.c_str(), &st) || st.st_ino != mapping.inode) {
+        // Replaced since it has been mapped, the mapping itself may
+        // still be readable.
+        path = str(boost::format("/proc/%d/map_files/%x-%x") %
+                pid % mapping.start % mapping.end);
+    }
+    try {
+        return std::unique_ptr<ElfSymbols>(new ElfSymbols(path));
+    } catch (const std::exception&) {
+        // Deleted or inaccessible, fine.
+        return nullptr;
+    }
+}
+
+} // namespace
+
+const FunctionId Symbolizer::UNKNOWN_FUNCTION;
+
+Symbolizer::Symbolizer() :
+    names_{"{unknown}"},
+    cacheHits_(0),
+    cacheMisses_(0)
+{}
+
+FunctionId Symbolizer::function(pid_t pid, unw_word_t ip) {
+    return withRange(pid, ip, [](const Range* range) {
+        return range ? range->function : UNKNOWN_FUNCTION;
+    });
+}
+
+void Symbolizer::resolveFunctions(
+        pid_t pid, std::vector<Frame>* stacktrace) {
+    for (auto& frame: *stacktrace) {
+        frame.function = function(pid, frame.ip);
+    }
+}
+
+const std::string& Symbolizer::name(FunctionId function) {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+    return names_.at(function);
+}
+
+bool Symbolizer::refreshMappings() {
+    std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+    bool changed = false;
+    for (auto iter = processes_.begin(); iter != processes_.end(); ) {
+        changed |= updateMappings(iter->first, &iter->second);
+        if (iter->second.mappings.empty()) {
+            // Gone.
+            iter = processes_.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    if (changed) {
+        dropUnusedFiles();
+    }
+    return changed;
+}
+
+template <class F>
+auto Symbolizer::withRange(pid_t pid, unw_word_t ip, F f)
+        -> decltype(f(nullptr)) {
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+        auto process = processes_.find(pid);
+        if (process != processes_.end()) {
+            if (const Range* range = findRange(process->second, ip)) {
+                cacheHits_.fetch_add(1, std::memory_order_relaxed);
+                return f(range);
+            }
+        }
+    }
+    cacheMisses_.fetch_add(1, std::memory_order_relaxed);
+    std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+    auto process = processes_.find(pid);
+    if (process == processes_.end()) {
+        process = processes_.emplace(pid, Process()).first;
+        updateMappings(pid, &process->second);
+    }
+    const Range* range = findRange(process->second, ip);
+    return f(range ? range : addRange(pid, &process->second, ip));
+}
+
+const Symbolizer::Range* Symbolizer::findRange(
+        const Process& process, unw_word_t ip) {
+    auto iter = process.ranges.upper_bound(ip);
+    if (iter == process.ranges.end() || iter->second.start > ip) {
+        return nullptr;
+    }
+    return &iter->second;
+}
+
+const Symbolizer::Range* Symbolizer::addRange(
+        pid_t pid, Process* process, unw_word_t ip) {
+    const Mapping* mapping = findMapping(process->mappings, ip);
+    if (!mapping) {
+        // Might be a library loaded since the last time.
+        if (std::chrono::steady_clock::now() - process->lastUpdate <
+                MIN_UPDATE_INTERVAL) {
+            return nullptr;
+        }
+        updateMappings(pid, process);
+        mapping = findMapping(process->mappings, ip);
+        if (!mapping) {
+            return nullptr;
+        }
+    }
+
+    auto key = fileKey(*mapping);
+    auto file = files_.find(key);
+    if (file == files_.end()) {
+        file = files_.emplace(key, loadSymbols(pid, *mapping)).first;
+    }
+
+    // Without symbols the whole mapping is one function.
+    unw_word_t start = mapping->start;
+    unw_word_t end = mapping->end;
+    const ElfSymbols::Symbol* symbol = nullptr;
+    unw_word_t vaddr;
+    if (file->second && file->second->fileOffsetToVaddr(
+                ip - mapping->start + mapping->offset, &vaddr)) {
+        unw_word_t begin;
+        unw_word_t symbolEnd;
+        symbol = file->second->find(vaddr, &begin, &symbolEnd);
+        // Translate back into the target's addresses,
+        // not going outside of the mapping.
+        start = ip - std::min(vaddr - begin, ip - mapping->start);
+        end = ip + std::min(symbolEnd - vaddr, mapping->end - ip);
+    }
+    Range range{start, intern(file->first, symbol ? symbol->name : nullptr)};
+
+    if (process->ranges.size() >= MAX_RANGES) {
+        process->ranges.clear();
+    }
+    return &(process->ranges[end] = range);
+}
+
+Symbolizer::FileKey Symbolizer::fileKey(const Mapping& mapping) {
+    return std::make_tuple(mapping.dev, mapping.inode, mapping.path);
+}
+
+bool Symbolizer::updateMappings(pid_t pid, Process* process) {
+    process->lastUpdate = std::chrono::steady_clock::now();
+    auto mappings = readExecutableMappings(pid);
+    if (mappings == process->mappings) {
+        return false;
+    }
+
+    for (const auto& mapping: process->mappings) {
+        if (std::find(mappings.begin(), mappings.end(), mapping) !=
+                mappings.end()) {
+            continue;
+        }
+        auto& ranges = process->ranges;
+        auto iter = ranges.upper_bound(mapping.start);
+        while (iter != ranges.end() && iter->second.start < mapping.end) {
+            iter = ranges.erase(iter);
+        }
+    }
+
+    process->mappings = std::move(mappings);
+    return true;
+}
+
+void Symbolizer::dropUnusedFiles() {
+    std::set<FileKey> keys;
+    for (const auto& kv: processes_) {
+        for (const auto& mapping: kv.second.mappings) {
+            keys.insert(fileKey(mapping));
+        }
+    }
+    for (auto iter = files_.begin(); iter != files_.end(); ) {
+        if (keys.count(iter->first)) {
+            ++iter;
+        } else {
+            iter = files_.erase(iter);
+        }
+    }
+}
+
+FunctionId Symbolizer::intern(const FileKey& file, const char* symbol) {
+    const auto& path = std::get<2>(file);
+    std::string key = str(boost::format("%s:%d:%s") %
+            std::get<0>(file) % std::get<1>(file) % path);
+    if (symbol) {
+        key.append(1, '\0').append(symbol);
+    }
+    auto inserted = functions_.emplace(key, names_.size());
+    if (inserted.second) {
+        if (symbol) {
+            names_.push_back(abbrev(demangle(symbol)));
+        } else {
+            auto slash = path.rfind('/');
+            names_.push_back("[" + (slash == std::string::npos ?
+                        path : path.substr(slash + 1)) + "]");
+        }
+    }
+    return inserted.first->second;
+}
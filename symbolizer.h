@@ -0,0 +1,101 @@
+#pragma once
+
+#include "elf_symbols.h"
+#include "frame.h"
+#include "mappings.h"
+
+#include <libunwind.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <unistd.h>
+
+// Resolves instruction pointers of target processes to functions.
+// Nothing is done until asked: mappings of a process are read on its
+// first lookup and symbol tables of a file are loaded when the first
+// address in that file is looked up.
+//
+// Resolved address ranges are cached per process, so that a single
+// entry covers all the addresses within a function. Lookups may be done
+// from many threads at once, only a cache miss takes an exclusive lock.
+//
+// Functions are interned: every function (or a whole file without
+// symbols) gets a dense id for the lifetime of the Symbolizer, and its
+// display name is demangled and abbreviated once. Symbol tables and
+// ids are shared by all the processes mapping the same file, told apart
+// by device and inode: the same path may stand for another file in
+// another container, or after an upgrade.
+class Symbolizer {
+public:
+    static const FunctionId UNKNOWN_FUNCTION = 0;
+
+    Symbolizer();
+
+    // Id of the function containing ip of process pid,
+    // or UNKNOWN_FUNCTION.
+    FunctionId function(pid_t pid, unw_word_t ip);
+    void resolveFunctions(pid_t pid, std::vector<Frame>* stacktrace);
+
+    // Valid as long as the Symbolizer is.
+    const std::string& name(FunctionId function);
+
+    // Lookups answered from the cached ranges, and the others.
+    uint64_t cacheHits() const { return cacheHits_; }
+    uint64_t cacheMisses() const { return cacheMisses_; }
+
+    // Rereads mappings of every process looked up so far, forgetting
+    // the processes which are gone and the files nobody maps anymore.
+    // Returns true if there were changes.
+    bool refreshMappings();
+
+private:
+    // All the addresses in [start, end) belong to the same function.
+    struct Range {
+        unw_word_t start;
+        FunctionId function;
+    };
+
+    // Device, inode and path of a mapped file.
+    typedef std::tuple<std::string, unsigned long, std::string> FileKey;
+
+    struct Process {
+        std::vector<Mapping> mappings;
+        std::chrono::steady_clock::time_point lastUpdate;
+        // Keyed by the end of the range.
+        std::map<unw_word_t, Range> ranges;
+    };
+
+    template <class F>
+    auto withRange(pid_t pid, unw_word_t ip, F f) -> decltype(f(nullptr));
+
+    // These require the lock to be held.
+    static const Range* findRange(const Process& process, unw_word_t ip);
+    // Exclusive lock only.
+    const Range* addRange(pid_t pid, Process* process, unw_word_t ip);
+    bool updateMappings(pid_t pid, Process* process);
+    static FileKey fileKey(const Mapping& mapping);
+    // Drops the symbols of files no process maps anymore.
+    void dropUnusedFiles();
+    FunctionId intern(const FileKey& file, const char* symbol);
+
+    std::shared_timed_mutex mutex_;
+    std::map<pid_t, Process> processes_;
+    // Files without symbols are here too, with null pointer.
+    std::map<FileKey, std::unique_ptr<ElfSymbols>> files_;
+    // Keyed by file and symbol name.
+    std::unordered_map<std::string, FunctionId> functions_;
+    std::deque<std::string> names_;
+
+    std::atomic<uint64_t> cacheHits_;
+    std::atomic<uint64_t> cacheMisses_;
+};
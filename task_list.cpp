@@ -0,0 +1,84 @@
+#include "task_list.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+using boost::filesystem::directory_iterator;
+
+std::vector<pid_t> listTasks(pid_t pid) {
+    std::vector<pid_t> tids;
+    for (directory_iterator i(str(
+                    boost::format("/proc/%d/task") % pid)), i_end;
+            i != i_end; ++i) {
+        if (!is_directory(i->status())) {
+            continue;
+        }
+        tids.push_back(
+                boost::lexical_cast<pid_t>(i->path().filename().string()));
+    }
+    return tids;
+}
+
+pid_t processOf(pid_t tid) {
+    std::ifstream status(str(boost::format("/proc/%d/status") % tid));
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 5, "Tgid:") == 0) {
+            return atoi(line.c_str() + 5);
+        }
+    }
+    return tid;
+}
+
+std::vector<pid_t> listDescendants(pid_t pid) {
+    std::multimap<pid_t, pid_t> children;
+    for (directory_iterator i("/proc"), i_end; i != i_end; ++i) {
+        pid_t child = atoi(i->path().filename().c_str());
+        if (child <= 0) {
+            continue;
+        }
+        std::ifstream stat(str(boost::format("/proc/%d/stat") % child));
+        std::string line;
+        if (!std::getline(stat, line)) {
+            continue;
+        }
+        // "pid (comm) state ppid ...", comm may contain anything.
+        auto paren = line.rfind(')');
+        if (paren == std::string::npos) {
+            continue;
+        }
+        std::istringstream fields(line.substr(paren + 1));
+        char state;
+        pid_t parent;
+        if (fields >> state >> parent) {
+            children.emplace(parent, child);
+        }
+    }
+
+    std::vector<pid_t> descendants;
+    std::vector<pid_t> queue{pid};
+    while (!queue.empty()) {
+        pid_t parent = queue.back();
+        queue.pop_back();
+        auto range = children.equal_range(parent);
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            descendants.push_back(iter->second);
+            queue.push_back(iter->second);
+        }
+    }
+    return descendants;
+}
+
+std::string threadName(pid_t pid, pid_t tid) {
+    std::ifstream comm(str(
+                boost::format("/proc/%d/task/%d/comm") % pid % tid));
+    std::string name;
+    std::getline(comm, name);
+    return name;
+}
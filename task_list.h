@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Ids of the threads currently listed in /proc/<pid>/task.
+std::vector<pid_t> listTasks(pid_t pid);
+
+// Thread group id of the thread, that is the process it belongs to,
+// or the tid itself if the thread is gone.
+pid_t processOf(pid_t tid);
+
+// Children of the process, their children and so on.
+std::vector<pid_t> listDescendants(pid_t pid);
+
+// Name of the thread as in /proc/<pid>/task/<tid>/comm,
+// empty if the thread is gone.
+std::string threadName(pid_t pid, pid_t tid);
@@ -2,10 +2,16 @@
 
 #include <curses.h>
 
+namespace {
+
 class TextTable {
 public:
     TextTable() {
         initscr();
+        cbreak();
+        noecho();
+        nodelay(stdscr, TRUE);
+        keypad(stdscr, TRUE);
     }
 
     ~TextTable() {
@@ -13,14 +19,32 @@ public:
     }
 };
 
-void putLines(const std::vector<std::string>& lines) {
+void init() {
     static TextTable textTable;
+}
+
+} // namespace
+
+void putLines(const std::vector<std::string>& lines, int highlighted) {
+    init();
 
     erase();
     move(0, 0);
     int y = 0;
     for (const auto& line: lines) {
-        mvaddstr(y++, 0, line.c_str());
+        if (y == highlighted) {
+            attron(A_REVERSE);
+        }
+        mvaddstr(y, 0, line.c_str());
+        if (y++ == highlighted) {
+            attroff(A_REVERSE);
+        }
     }
     refresh();
 }
+
+int readKey() {
+    init();
+    int key = getch();
+    return key == ERR ? -1 : key;
+}
@@ -3,4 +3,7 @@
 #include <string>
 #include <vector>
 
-void putLines(const std::vector<std::string> &lines);
+// The line with index highlighted, if any, is shown in reverse video.
+void putLines(const std::vector<std::string> &lines, int highlighted = -1);
+// Returns a key pressed, or -1 if none. Doesn't wait.
+int readKey();
@@ -0,0 +1,96 @@
+#include "thread_activity.h"
+#include "file_limit.h"
+
+#include <boost/format.hpp>
+
+#include <atomic>
+#include <cstdio>
+
+#include <fcntl.h>
+
+namespace {
+
+// Files each reader holding them has open.
+const size_t FILES_PER_READER = 2;
+
+std::atomic<size_t> heldFiles(0);
+
+size_t maxHeldFiles() {
+    static const size_t max = raiseFileLimit() / 2;
+    return max;
+}
+
+int openTaskFile(pid_t pid, pid_t tid, const char* name) {
+    return open(str(boost::format("/proc/%d/task/%d/%s") %
+                pid % tid % name).c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+// Reads the whole (short) file from the start as a C string.
+bool readText(const FileDescriptor& fd, char* buffer, size_t size) {
+    if (fd.get() == -1) {
+        return false;
+    }
+    ssize_t length = pread(fd.get(), buffer, size - 1, 0);
+    if (length <= 0) {
+        return false;
+    }
+    buffer[length] = '\0';
+    return true;
+}
+
+} // namespace
+
+ThreadActivityReader::ThreadActivityReader(pid_t pid, pid_t tid) :
+    pid_(pid),
+    tid_(tid),
+    isHoldingFiles_(heldFiles.fetch_add(FILES_PER_READER) +
+            FILES_PER_READER <= maxHeldFiles())
+{
+    if (isHoldingFiles_) {
+        schedstat_.reset(openTaskFile(pid, tid, "schedstat"));
+        syscall_.reset(openTaskFile(pid, tid, "syscall"));
+    } else {
+        heldFiles -= FILES_PER_READER;
+    }
+}
+
+ThreadActivityReader::~ThreadActivityReader() {
+    if (isHoldingFiles_) {
+        heldFiles -= FILES_PER_READER;
+    }
+}
+
+bool ThreadActivityReader::read(ThreadActivity* activity) {
+    FileDescriptor schedstat;
+    FileDescriptor syscall;
+    if (!isHoldingFiles_) {
+        schedstat.reset(openTaskFile(pid_, tid_, "schedstat"));
+        syscall.reset(openTaskFile(pid_, tid_, "syscall"));
+    }
+    const auto& schedstatFile = isHoldingFiles_ ? schedstat_ : schedstat;
+    const auto& syscallFile = isHoldingFiles_ ? syscall_ : syscall;
+
+    char buffer[256];
+    unsigned long long runNanoseconds, waitNanoseconds, timeslices;
+    if (!readText(schedstatFile, buffer, sizeof(buffer)) ||
+            sscanf(buffer, "%llu %llu %llu", &runNanoseconds,
+                &waitNanoseconds, &timeslices) != 3) {
+        return false;
+    }
+    activity->runNanoseconds = runNanoseconds;
+    activity->timeslices = timeslices;
+
+    // The syscall number, six arguments, the stack pointer and the
+    // program counter of a thread blocked in a syscall. Anything else,
+    // like "running", counts as not blocked.
+    if (!readText(syscallFile, buffer, sizeof(buffer))) {
+        return false;
+    }
+    long number;
+    unsigned long sp, ip;
+    activity->isBlocked = sscanf(buffer,
+            "%ld %*s %*s %*s %*s %*s %*s %lx %lx", &number, &sp, &ip) == 3;
+    activity->sp = activity->isBlocked ? sp : 0;
+    activity->ip = activity->isBlocked ? ip : 0;
+    return true;
+}
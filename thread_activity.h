@@ -0,0 +1,42 @@
+#pragma once
+
+#include "file_descriptor.h"
+
+#include <libunwind.h>
+
+#include <cstdint>
+
+#include <unistd.h>
+
+// Signs of a thread having run, read from /proc without stopping it.
+struct ThreadActivity {
+    // From schedstat: time spent on a CPU and timeslices run.
+    uint64_t runNanoseconds;
+    uint64_t timeslices;
+    // From syscall: whether the thread is blocked in the kernel,
+    // and its user stack pointer and instruction pointer if it is.
+    bool isBlocked;
+    unw_word_t sp;
+    unw_word_t ip;
+};
+
+// Keeps the files open, so that reading costs two preads, as long as
+// all the readers together hold less than half of the open file limit.
+// Beyond that, with thousands of threads, the files are opened on every
+// read instead, leaving files for symbols, outputs and the like.
+class ThreadActivityReader {
+public:
+    ThreadActivityReader(pid_t pid, pid_t tid);
+    ~ThreadActivityReader();
+
+    // Returns false if the files are not available,
+    // for example without CONFIG_SCHED_INFO or when the thread is gone.
+    bool read(ThreadActivity* activity);
+
+private:
+    pid_t pid_;
+    pid_t tid_;
+    bool isHoldingFiles_;
+    FileDescriptor schedstat_;
+    FileDescriptor syscall_;
+};
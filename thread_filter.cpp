@@ -0,0 +1,68 @@
+#include "thread_filter.h"
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+bool isTid(const std::string& s) {
+    return !s.empty() && std::all_of(s.begin(), s.end(),
+            [](char c) { return isdigit(static_cast<unsigned char>(c)); });
+}
+
+bool matchesAny(
+        const std::vector<std::regex>& regexes, const std::string& name) {
+    for (const auto& regex: regexes) {
+        if (std::regex_search(name, regex)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+void ThreadFilter::includeNames(const std::string& regex) {
+    includedNames_.emplace_back(regex, std::regex::extended);
+}
+
+void ThreadFilter::excludeNames(const std::string& regex) {
+    excludedNames_.emplace_back(regex, std::regex::extended);
+}
+
+void ThreadFilter::include(const std::string& tidOrRegex) {
+    if (isTid(tidOrRegex)) {
+        include(boost::lexical_cast<pid_t>(tidOrRegex));
+    } else {
+        includeNames(tidOrRegex);
+    }
+}
+
+void ThreadFilter::exclude(const std::string& tidOrRegex) {
+    if (isTid(tidOrRegex)) {
+        exclude(boost::lexical_cast<pid_t>(tidOrRegex));
+    } else {
+        excludeNames(tidOrRegex);
+    }
+}
+
+bool ThreadFilter::isEmpty() const {
+    return includedTids_.empty() && excludedTids_.empty() &&
+        includedNames_.empty() && excludedNames_.empty();
+}
+
+bool ThreadFilter::needsNames() const {
+    return !includedNames_.empty() || !excludedNames_.empty();
+}
+
+bool ThreadFilter::matches(pid_t tid, const std::string& name) const {
+    if (excludedTids_.count(tid) || matchesAny(excludedNames_, name)) {
+        return false;
+    }
+    if (includedTids_.empty() && includedNames_.empty()) {
+        return true;
+    }
+    return includedTids_.count(tid) || matchesAny(includedNames_, name);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <regex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Which threads get sampled, by tid or by name (as in /proc/.../comm).
+// A thread is sampled if it matches one of the includes, or there are
+// none, and none of the excludes. Names are matched by regex_search,
+// so a part of the name does. Names change, so threads are attached to
+// whatever their name, and those filtered out are only traced for the
+// threads they create; threads excluded by tid are not attached to.
+class ThreadFilter {
+public:
+    void include(pid_t tid) { includedTids_.insert(tid); }
+    void exclude(pid_t tid) { excludedTids_.insert(tid); }
+    // Throws std::regex_error if the expression is not valid.
+    void includeNames(const std::string& regex);
+    void excludeNames(const std::string& regex);
+    // A tid if all digits, a name regex otherwise.
+    void include(const std::string& tidOrRegex);
+    void exclude(const std::string& tidOrRegex);
+
+    bool isEmpty() const;
+    // Whether matches() looks at names at all.
+    bool needsNames() const;
+    bool matches(pid_t tid, const std::string& name) const;
+    // Whether the thread is excluded whatever its name.
+    bool excludes(pid_t tid) const { return excludedTids_.count(tid); }
+
+private:
+    std::set<pid_t> includedTids_;
+    std::set<pid_t> excludedTids_;
+    std::vector<std::regex> includedNames_;
+    std::vector<std::regex> excludedNames_;
+};
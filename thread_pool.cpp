@@ -0,0 +1,53 @@
+#include "thread_pool.h"
+
+#include <signal.h>
+
+ThreadPool::ThreadPool(size_t threads) :
+    isStopping_(false)
+{
+    for (size_t i = 0; i != threads; ++i) {
+        threads_.emplace_back([=] { worker(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        isStopping_ = true;
+    }
+    hasTasks_.notify_all();
+    for (auto& thread: threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::post(std::function<void()> task) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    hasTasks_.notify_one();
+}
+
+void ThreadPool::worker() {
+    // Signals are the business of the event loop.
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            hasTasks_.wait(lock, [&] {
+                return isStopping_ || !tasks_.empty();
+            });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
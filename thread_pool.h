@@ -0,0 +1,26 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads);
+    // Runs all the pending tasks before returning.
+    ~ThreadPool();
+
+    void post(std::function<void()> task);
+
+private:
+    void worker();
+
+    std::mutex mutex_;
+    std::condition_variable hasTasks_;
+    std::deque<std::function<void()>> tasks_;
+    bool isStopping_;
+    std::vector<std::thread> threads_;
+};
@@ -1,15 +1,16 @@
 #pragma once
 
-#include "frame.h"
+#include "sample_batch.h"
 
-#include <map>
-#include <vector>
-
-#include <unistd.h>
+#include <string>
 
 class Tracer {
 public:
-    virtual void tick(std::map<pid_t, std::vector<Frame>> stacktraces) = 0;
+    // The batch is only valid during the call.
+    virtual void tick(const SampleBatch& batch) = 0;
     virtual void addInfoLine(const std::string& info) = 0;
+    // Unlike info lines, status stays until replaced by the next value.
+    virtual void setStatus(
+            const std::string& /* name */, const std::string& /* value */) {}
     virtual ~Tracer() {}
 };
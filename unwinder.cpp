@@ -0,0 +1,15 @@
+#include "unwinder.h"
+
+#include <chrono>
+
+std::vector<Frame> Unwinder::unwind(const StackSnapshot& snapshot) {
+    auto start = std::chrono::steady_clock::now();
+    auto stacktrace = unwindImpl(snapshot);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    ++stats_->samples;
+    stats_->frames += stacktrace.size();
+    stats_->nanoseconds +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    return stacktrace;
+}
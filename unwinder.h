@@ -0,0 +1,31 @@
+#pragma once
+
+#include "frame.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+struct StackSnapshot;
+
+// Cost of unwinding, accumulated over all threads.
+struct UnwindStats {
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> nanoseconds{0};
+};
+
+class Unwinder {
+public:
+    static const size_t MAX_DEPTH = 200;
+
+    explicit Unwinder(UnwindStats* stats): stats_(stats) {}
+    virtual ~Unwinder() {}
+
+    std::vector<Frame> unwind(const StackSnapshot& snapshot);
+
+private:
+    virtual std::vector<Frame> unwindImpl(const StackSnapshot& snapshot) = 0;
+
+    UnwindStats* stats_;
+};
@@ -1,8 +1,9 @@
 #include "wat.h"
 #include "exception.h"
 #include "profiler.h"
-#include "signal_handler.h"
-#include "symbols.h"
+#include "snapshot.h"
+#include "symbolizer.h"
+#include "task_list.h"
 
 #include <boost/format.hpp>
 
@@ -12,11 +13,16 @@
 
 #include <string.h>
 #include <sys/ptrace.h>
-#include <sys/syscall.h>
 #include <sys/wait.h>
 
 namespace {
 
+const std::chrono::seconds FILTER_CHECK_INTERVAL(1);
+// Run time resuming a thread into its syscall takes, some microseconds.
+// A syscall returning right away and user code running until the next
+// one would rarely fit.
+const uint64_t MAX_RESTART_NANOSECONDS = 50000;
+
 template <class F>
 void convertThreadErrors(F f) {
     try {
@@ -61,200 +67,283 @@ void ptraceCmd(__ptrace_request request, pid_t tid, T arg) {
     });
 }
 
-void assertStopped(int status) {
-    assert(WIFSTOPPED(status));
-    assert(WSTOPSIG(status) == SIGSTOP);
+uint64_t nanosecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+bool isGroupStopSignal(int signal) {
+    return signal == SIGSTOP ||
+        signal == SIGTSTP ||
+        signal == SIGTTIN ||
+        signal == SIGTTOU;
 }
 
 } // namespace
 
+void StacktraceRound::expect() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++pending_;
+}
+
+void StacktraceRound::seal() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    isSealed_ = true;
+    if (!pending_) {
+        isDone_.notify_all();
+    }
+}
+
+void StacktraceRound::complete(
+        pid_t pid, pid_t tid, const std::vector<Frame>& stacktrace) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    batch_->add(pid, tid, stacktrace);
+    done(lock);
+}
+
+void StacktraceRound::fail(const std::string& error) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    errors_.push_back(error);
+    done(lock);
+}
+
+void StacktraceRound::skip() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done(lock);
+}
+
+void StacktraceRound::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    isDone_.wait(lock, [&] { return isSealed_ && !pending_; });
+}
+
+void StacktraceRound::done(std::unique_lock<std::mutex>&) {
+    assert(pending_);
+    if (!--pending_ && isSealed_) {
+        isDone_.notify_all();
+    }
+}
+
 WatTracer::WatTracer(pid_t pid, pid_t tid, Profiler* profiler) :
         pid_(pid),
         tid_(tid),
         profiler_(profiler),
-        addressSpace_(
-                throwUnwindIf0(unw_create_addr_space(&_UPT_accessors, 0)),
-                &unw_destroy_addr_space),
+        addressSpace_(profiler_->addressSpace(pid_)),
         unwindInfo_(throwUnwindIf0(_UPT_create(tid_)), &_UPT_destroy),
-        isAlive_(true),
-        isStacktracePending_(false),
-        doDetach_(false),
-        thread_([=] { tracer(); })
+        isSampled_(true),
+        activityReader_(pid_, tid_),
+        isActivityKnown_(false),
+        isActivityReadStopped_(false),
+        lastSp_(0),
+        lastIp_(0),
+        hasLastStacktrace_(false),
+        isStoppedForUnwinding_(false),
+        isInGroupStop_(false),
+        doDetach_(false)
 {
-    try {
-        ready_.get_future().get();
-    } catch (...) {
-        // Prevent thread leak
-        thread_.join();
-        throw;
-    }
+    unwinder_ = profiler_->newUnwinder(
+            addressSpace_.get(), unwindInfo_.get(), &fallbackUnwinder_);
 }
 
 WatTracer::~WatTracer() {
-    {
-        std::unique_lock<std::mutex> lock(mutex_);
+    if (pendingRound_) {
+        pendingRound_->skip();
+    }
+}
 
-        if (isAlive_) {
-            throwErrnoIfMinus1RestartIfEintr([&] {
-                return pthread_kill(thread_.native_handle(), SIGTERM);
-            });
+bool WatTracer::attach() {
+    // Unlike PTRACE_ATTACH, this doesn't send any signals.
+    long options = PTRACE_O_TRACECLONE;
+    if (profiler_->options_.followForks) {
+        options |= PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK;
+    }
+    ptraceCmd(PTRACE_SEIZE, tid_, options);
+    if (!isSampled()) {
+        // Traced only for the threads it creates, and in case it gets
+        // another name.
+        return false;
+    }
+    ptraceCmd(PTRACE_INTERRUPT, tid_, 0);
+    for (;;) {
+        int status;
+        throwErrnoIfMinus1RestartIfEintr([&] {
+            return waitpid(tid_, &status, __WALL);
+        });
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            throw ThreadIsGone();
+        }
+        assert(WIFSTOPPED(status));
+        if (status >> 16 == PTRACE_EVENT_STOP) {
+            isInGroupStop_ = isGroupStopSignal(WSTOPSIG(status));
+            return true;
         }
+        if (status >> 16) {
+            // Cloned or forked before the interrupt. The child is
+            // traced already and reports its own stop, the SIGTRAP
+            // of the event is not to be delivered.
+            ptraceCmd(PTRACE_CONT, tid_, 0);
+            continue;
+        }
+        // A signal has been delivered before the interrupt,
+        // let the thread have it.
+        ptraceCmd(PTRACE_CONT, tid_, WSTOPSIG(status));
     }
-
-    thread_.join();
 }
 
-std::future<std::vector<Frame>> WatTracer::stacktrace() {
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (!isAlive_) {
-        throw std::runtime_error(
-            "Cannot obtain stacktrace: thread has terminated already");
+void WatTracer::cont() {
+    // A thread stopped by job control must stay stopped,
+    // while remaining available for PTRACE_INTERRUPT.
+    ptraceCmd(isInGroupStop_ ? PTRACE_LISTEN : PTRACE_CONT, tid_, 0);
+    if (stoppedAt_ != std::chrono::steady_clock::time_point()) {
+        profiler_->stopped_.record(nanosecondsSince(stoppedAt_));
+        stoppedAt_ = std::chrono::steady_clock::time_point();
     }
-    assert(!isStacktracePending_);
-    isStacktracePending_ = true;
-    stackPromise_ = std::promise<std::vector<Frame>>();
-    convertThreadErrors([=] {
-        throwErrnoIfMinus1RestartIfEintr([=] {
-            return syscall(SYS_tgkill, pid_, tid_, SIGSTOP);
-        });
-    });
-    return stackPromise_.get_future();
 }
 
-void WatTracer::tracer() {
-    auto handleSigterm = [&] {
-        std::unique_lock<std::mutex> lock(mutex_);
-        doDetach_ = true;
-        throwErrnoIfMinus1RestartIfEintr([&] {
-            return syscall(SYS_tgkill, pid_, tid_, SIGSTOP);
-        });
-    };
+bool WatTracer::requestStacktrace(std::shared_ptr<StacktraceRound> round) {
+    assert(!pendingRound_);
+    if (!isSampled()) {
+        return true;
+    }
+    if (isIdle()) {
+        round->expect();
+        round->complete(pid_, tid_, lastStacktrace_);
+        ++profiler_->reusedStacktraces_;
+        return true;
+    }
     try {
-        try {
-            ptraceCmd(PTRACE_ATTACH, tid_, 0);
-            int status;
-            throwErrnoIfMinus1RestartIfEintr([&] {
-                return waitpid(tid_, &status, __WALL);
-            });
-            if (WIFEXITED(status)) {
-                throw ThreadIsGone();
-            } else {
-                assertStopped(status);
-            }
-            ptraceCmd(PTRACE_SETOPTIONS, tid_, PTRACE_O_TRACECLONE);
-        } catch (...) {
-            ready_.set_exception(std::current_exception());
-            std::unique_lock<std::mutex> lock(mutex_);
-            isAlive_ = false;
-            return;
-        }
-
-        ready_.set_value();
+        stop();
+    } catch (const ThreadIsGone&) {
+        return false;
+    }
+    interruptedAt_ = std::chrono::steady_clock::now();
+    round->expect();
+    pendingRound_ = std::move(round);
+    return true;
+}
 
-        goodToGo_.get_future().get();
+bool WatTracer::onUnwound() {
+    isStoppedForUnwinding_ = false;
+    if (doDetach_) {
+        ptraceCmd(PTRACE_DETACH, tid_, 0);
+        return false;
+    }
+    cont();
+    return true;
+}
 
-        ptraceCmd(PTRACE_CONT, tid_, 0);
-        handleSignals({SIGTERM}, {SIGINT});
+void WatTracer::detach() {
+    doDetach_ = true;
+    // Otherwise detached as soon as unwound.
+    if (!isStoppedForUnwinding_) {
+        stop();
+    }
+}
 
-        for (;;) {
-            if (lastSignal() == SIGTERM) {
-                handleSigterm();
-            }
-            resetLastSignal();
+bool WatTracer::isSampled() {
+    const auto& filter = profiler_->options_.threadFilter;
+    if (!filter.needsNames()) {
+        return filter.matches(tid_, std::string());
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now - filterCheckedAt_ >= FILTER_CHECK_INTERVAL) {
+        filterCheckedAt_ = now;
+        isSampled_ = filter.matches(tid_, threadName(pid_, tid_));
+    }
+    return isSampled_;
+}
 
-            int status;
-            pid_t tid = waitpid(tid_, &status, __WALL);
-            if (tid == tid_) {
-                if (!onTraceeStatusChanged(status)) {
-                    break;
-                }
-                continue;
-            }
-            if (errno != EINTR) {
-                throwErrnoIfMinus1(tid);
-            }
-            if (!lastSignal()) {
-                continue;
-            }
-            if (lastSignal() == SIGTERM) {
-                handleSigterm();
-                resetLastSignal();
-            } else {
-                throw std::logic_error(str(boost::format(
-                        "Unexpected signal received: tid=%d, signal=%d (%s)") %
-                                tid_ % lastSignal()% strsignal(lastSignal())));
-            }
-        }
-        std::unique_lock<std::mutex> lock(mutex_);
-        isAlive_ = false;
-    } catch (const std::exception& e) {
-        std::cerr << ">>> Oh no you don't! " << e.what() << std::endl;
-        std::unique_lock<std::mutex> lock(mutex_);
-        isAlive_ = false;
-        raise(SIGABRT);
+bool WatTracer::isIdle() {
+    ThreadActivity activity;
+    if (!activityReader_.read(&activity)) {
+        isActivityKnown_ = false;
+        return false;
     }
+    ThreadActivity last = lastActivity_;
+    bool wasActivityKnown = isActivityKnown_;
+    bool wasReadStopped = isActivityReadStopped_;
+    lastActivity_ = activity;
+    isActivityKnown_ = true;
+    isActivityReadStopped_ = false;
+
+    // Still blocked where it has been stopped last time...
+    if (!hasLastStacktrace_ || !wasActivityKnown || !activity.isBlocked ||
+            activity.sp != lastSp_ || activity.ip != lastIp_) {
+        return false;
+    }
+    // ...and has not been scheduled since. Read during the stop, the
+    // counts only miss the one timeslice resuming takes to restart the
+    // syscall, which runs no longer than that.
+    if (wasReadStopped) {
+        return activity.timeslices == last.timeslices + 1 &&
+            activity.runNanoseconds - last.runNanoseconds <=
+                MAX_RESTART_NANOSECONDS;
+    }
+    return activity.timeslices == last.timeslices &&
+        activity.runNanoseconds == last.runNanoseconds;
+}
+
+void WatTracer::stop() {
+    // Interrupts requested before the thread reports the stop
+    // collapse into one, and are forgotten on detach.
+    ptraceCmd(PTRACE_INTERRUPT, tid_, 0);
 }
 
 bool WatTracer::onTraceeStatusChanged(int status) {
     if (WIFEXITED(status)) {
-        profiler_->endThread(tid_);
         return false;
     } else if (WIFSIGNALED(status)) {
-        profiler_->endThread(tid_);
-        stackPromise_.set_exception(
-                std::make_exception_ptr(std::runtime_error(
-                        str(boost::format(
+        if (pendingRound_) {
+            pendingRound_->fail(str(boost::format(
                             "Process is killed by deadly signal %d") %
-                            WTERMSIG(status)))));
+                        WTERMSIG(status)));
+            pendingRound_.reset();
+        }
         return false;
     } else if (WIFSTOPPED(status)) {
-        int deliveredSignal = WSTOPSIG(status);
-        switch (deliveredSignal) {
-            // group-stop
-            case SIGSTOP:
-                {
-                    std::unique_lock<std::mutex> lock(mutex_);
-
-                    if (doDetach_) {
-                        ptraceCmd(PTRACE_DETACH, tid_, 0);
-                        return false;
-                    }
-
-                    if (!isStacktracePending_) {
-                        deliveredSignal = 0;
-                    } else {
-                        isStacktracePending_ = false;
-                        stackPromise_.set_value(stacktraceImpl());
-                        deliveredSignal = 0;
-                    }
+        int deliveredSignal = 0;
+        switch (status >> 16) {
+            // Either PTRACE_INTERRUPT, or the initial stop
+            // of a new thread, or a group-stop.
+            case PTRACE_EVENT_STOP:
+                isInGroupStop_ = isGroupStopSignal(WSTOPSIG(status));
+                if (doDetach_) {
+                    ptraceCmd(PTRACE_DETACH, tid_, 0);
+                    return false;
+                }
+                if (pendingRound_ && onStopped()) {
+                    return true;
                 }
-            break;
-            // group-stop
-            case SIGTSTP:
-            case SIGTTIN:
-            case SIGTTOU:
-                // The thread is stopped, but it wasn't us. Not sure what to do.
-                deliveredSignal = 0;
                 break;
-            case SIGTRAP:
-                if (status >> 16 == PTRACE_EVENT_CLONE) {
-                    deliveredSignal = 0;
+            case PTRACE_EVENT_CLONE:
+                {
                     long newTid;
-                    // The newly created thread starts in stopped state.
-                    // We detach it and then reattach it from separate
-                    // thread which will handle this thread tracing.
+                    // The new thread is traced already
+                    // and is going to report its stop by itself.
                     ptraceCmd(PTRACE_GETEVENTMSG, tid_, &newTid);
-                    int status;
-                    throwErrnoIfMinus1RestartIfEintr([&] {
-                        return waitpid(newTid, &status, __WALL);
-                    });
-                    assert(WIFSTOPPED(status));
-                    ptraceCmd(PTRACE_DETACH, newTid, 0);
-                    profiler_->newThread(newTid);
+                    // Usually of the same process, but clone() without
+                    // CLONE_THREAD makes a new one.
+                    profiler_->newThread(processOf(newTid), newTid);
+                }
+                break;
+            case PTRACE_EVENT_FORK:
+            case PTRACE_EVENT_VFORK:
+                {
+                    long newPid;
+                    ptraceCmd(PTRACE_GETEVENTMSG, tid_, &newPid);
+                    profiler_->newThread(newPid, newPid);
                 }
-            break;
+                break;
+            // signal-delivery-stop, the signal is not ours.
+            case 0:
+                deliveredSignal = WSTOPSIG(status);
+                break;
+        }
+        if (deliveredSignal) {
+            ptraceCmd(PTRACE_CONT, tid_, deliveredSignal);
+        } else {
+            cont();
         }
-        ptraceCmd(PTRACE_CONT, tid_, deliveredSignal);
     } else {
         throw std::logic_error(str(boost::format(
                 "Unknown status reported: tid=%d, status=%d") %
@@ -263,38 +352,52 @@ bool WatTracer::onTraceeStatusChanged(int status) {
     return true;
 }
 
-std::vector<Frame> WatTracer::stacktraceImpl() {
-    std::vector<Frame> stacktrace;
-
-    unw_cursor_t cursor;
-    throwUnwindIfLessThan0(unw_init_remote(
-                &cursor, addressSpace_.get(), unwindInfo_.get()));
-    int depth = 0;
-    do {
-        unw_word_t ip;
-        unw_word_t sp;
-
-        throwUnwindIfLessThan0(unw_get_reg(&cursor, UNW_REG_IP, &ip));
-        throwUnwindIfLessThan0(unw_get_reg(&cursor, UNW_REG_SP, &sp));
-
-        std::string procName = getProcName(&cursor);
-        stacktrace.push_back({ip, sp, procName});
-
-        if (++depth == 200) {
-            break;
+bool WatTracer::onStopped() {
+    stoppedAt_ = std::chrono::steady_clock::now();
+    profiler_->stopLatency_.record(nanosecondsSince(interruptedAt_));
+    auto round = std::move(pendingRound_);
+    auto snapshot = takeSnapshot();
+    lastSp_ = snapshot->regs.rsp;
+    lastIp_ = snapshot->regs.rip;
+    hasLastStacktrace_ = false;
+    // Whatever stopping the thread has taken is behind it now.
+    isActivityKnown_ = activityReader_.read(&lastActivity_);
+    isActivityReadStopped_ = true;
+    auto self = shared_from_this();
+    // Unless asked otherwise, the thread stays stopped
+    // until it is unwound.
+    bool stayStopped = !profiler_->options_.unwindAfterResume;
+    isStoppedForUnwinding_ = stayStopped;
+    profiler_->unwindPool_.post([=] {
+        try {
+            self->lastStacktrace_ = self->stacktraceImpl(*snapshot);
+            self->hasLastStacktrace_ = true;
+            round->complete(pid_, tid_, self->lastStacktrace_);
+        } catch (const std::exception& e) {
+            round->fail(std::string("Exception: ") + e.what());
         }
-    } while (unw_step(&cursor) > 0);
-
-    return stacktrace;
+        if (stayStopped) {
+            profiler_->onUnwound(tid_);
+        }
+    });
+    return stayStopped;
 }
 
-StoppedWat::StoppedWat(pid_t pid, pid_t tid, Profiler* profiler) :
-    tracer_(std::unique_ptr<WatTracer>(new WatTracer(pid, tid, profiler)))
-{
+std::shared_ptr<StackSnapshot> WatTracer::takeSnapshot() {
+    auto snapshot = std::make_shared<StackSnapshot>();
+    snapshot->tid = tid_;
+    ptraceCmd(PTRACE_GETREGS, tid_, &snapshot->regs);
+    readStack(snapshot.get(), profiler_->options_.stackSnapshotSize);
+    return snapshot;
 }
 
-Wat::Wat(std::unique_ptr<WatTracer> tracer) :
-    tracer_(std::move(tracer))
-{
-    tracer_->goodToGo_.set_value();
+std::vector<Frame> WatTracer::stacktraceImpl(const StackSnapshot& snapshot) {
+    auto start = std::chrono::steady_clock::now();
+    auto stacktrace = unwinder_->unwind(snapshot);
+    if (stacktrace.size() < 2 && fallbackUnwinder_) {
+        stacktrace = fallbackUnwinder_->unwind(snapshot);
+    }
+    profiler_->symbolizer_->resolveFunctions(pid_, &stacktrace);
+    profiler_->unwinding_.record(nanosecondsSince(start));
+    return stacktrace;
 }
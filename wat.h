@@ -1,78 +1,144 @@
 #pragma once
 
+#include "address_space.h"
 #include "frame.h"
+#include "sample_batch.h"
+#include "thread_activity.h"
+#include "unwinder.h"
 
-#include <future>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
-#include <libunwind.h>
 #include <unistd.h>
 
 class Profiler;
-class Wat;
-class StoppedWat;
+struct StackSnapshot;
 
-class WatTracer {
+// Stacktraces of all the threads requested at once,
+// collected into the batch given.
+class StacktraceRound {
 public:
-    ~WatTracer();
+    // Threads are stopped one by one over spread,
+    // or all at once if it is zero.
+    explicit StacktraceRound(
+            SampleBatch* batch,
+            std::chrono::microseconds spread = std::chrono::microseconds(0)) :
+        batch_(batch), spread_(spread), pending_(0), isSealed_(false)
+    {}
 
-private:
-    WatTracer(pid_t pid, pid_t tid, Profiler* profiler);
-    std::future<std::vector<Frame>> stacktrace();
+    std::chrono::microseconds spread() const { return spread_; }
 
-    friend class Wat;
-    friend class StoppedWat;
+    void expect();
+    // No more threads are going to be expected.
+    void seal();
 
-    void tracer();
-    bool onTraceeStatusChanged(int status);
-    std::vector<Frame> stacktraceImpl();
+    void complete(
+            pid_t pid, pid_t tid, const std::vector<Frame>& stacktrace);
+    void fail(const std::string& error);
+    // The thread is gone before its stacktrace was taken.
+    void skip();
 
-    pid_t pid_;
-    pid_t tid_;
-    Profiler* profiler_;
-    std::unique_ptr<
-        struct unw_addr_space,
-        void (*)(unw_addr_space_t)> addressSpace_;
-    std::unique_ptr<
-        void,
-        void (*)(void *)> unwindInfo_;
-    std::promise<std::vector<Frame>> stackPromise_;
-    std::promise<void> ready_;
-    std::promise<void> goodToGo_;
-
-    std::mutex mutex_;
-    bool isAlive_;
-    bool isStacktracePending_;
-    bool doDetach_;
-
-    std::thread thread_;
-};
+    // Waits for all the expected threads.
+    void wait();
 
-class Wat {
-public:
-    explicit Wat(std::unique_ptr<WatTracer> tracer);
-
-    std::future<std::vector<Frame>> stacktrace() {
-        return tracer_->stacktrace();
-    }
-
-    Wat(Wat&&) = default;
-    Wat& operator=(Wat&&) = default;
+    const std::vector<std::string>& errors() const { return errors_; }
 
 private:
-    std::unique_ptr<WatTracer> tracer_;
+    void done(std::unique_lock<std::mutex>& lock);
+
+    SampleBatch* batch_;
+    std::chrono::microseconds spread_;
+    std::mutex mutex_;
+    std::condition_variable isDone_;
+    size_t pending_;
+    bool isSealed_;
+    std::vector<std::string> errors_;
 };
 
-class StoppedWat {
+// A single traced thread. All the ptrace requests must come from
+// the thread which has attached the tracee, so the methods are called
+// from the supervisor thread of the Profiler only. Unwinding is done
+// on the unwind pool.
+class WatTracer : public std::enable_shared_from_this<WatTracer> {
 public:
-    StoppedWat(pid_t pid, pid_t tid, Profiler* profiler);
-
-    Wat continueWat() && { return Wat(std::move(tracer_)); }
+    WatTracer(pid_t pid, pid_t tid, Profiler* profiler);
+    ~WatTracer();
 
-    StoppedWat(StoppedWat&&) = default;
-    StoppedWat& operator=(StoppedWat&&) = default;
+    pid_t tid() const { return tid_; }
+
+    // Attaches to the thread and, unless it is filtered out, waits
+    // until it is stopped. Returns true if the thread is left stopped.
+    bool attach();
+    // Resumes the thread after any ptrace-stop.
+    void cont();
+
+    // Stops the thread to take its stacktrace for the round, or reuses
+    // the previous one right away if the thread has not run since.
+    // Returns false if the thread is gone.
+    bool requestStacktrace(std::shared_ptr<StacktraceRound> round);
+    // Continues the thread left stopped for unwinding. Returns false
+    // if the thread has been detached instead and should be forgotten.
+    bool onUnwound();
+    // The thread is detached as soon as it stops.
+    void detach();
+
+    // Returns false when the thread is gone or detached,
+    // and should be forgotten.
+    bool onTraceeStatusChanged(int status);
 
 private:
-    std::unique_ptr<WatTracer> tracer_;
+    void stop();
+    // Whether the thread passes the filter of the profiler.
+    bool isSampled();
+    // Whether the thread has provably not run since its last stacktrace.
+    bool isIdle();
+    // Returns true if the thread has been left stopped.
+    bool onStopped();
+    std::shared_ptr<StackSnapshot> takeSnapshot();
+    std::vector<Frame> stacktraceImpl(const StackSnapshot& snapshot);
+
+    pid_t pid_;
+    pid_t tid_;
+    Profiler* profiler_;
+    std::shared_ptr<AddressSpace> addressSpace_;
+    std::unique_ptr<
+        void,
+        void (*)(void *)> unwindInfo_;
+    std::unique_ptr<Unwinder> unwinder_;
+    // Used when unwinder_ fails to go past the topmost frame.
+    std::unique_ptr<Unwinder> fallbackUnwinder_;
+
+    bool isSampled_;
+    // Threads get renamed, so names are checked again once a second.
+    std::chrono::steady_clock::time_point filterCheckedAt_;
+
+    ThreadActivityReader activityReader_;
+    ThreadActivity lastActivity_;
+    bool isActivityKnown_;
+    // lastActivity_ has been read while the thread was stopped.
+    bool isActivityReadStopped_;
+    // Where the thread has been stopped for the last stacktrace.
+    unw_word_t lastSp_;
+    unw_word_t lastIp_;
+    // Written by the unwind pool. A round is over before the next one
+    // is requested, so the supervisor sees them complete.
+    std::vector<Frame> lastStacktrace_;
+    bool hasLastStacktrace_;
+
+    std::shared_ptr<StacktraceRound> pendingRound_;
+    // When the thread has been interrupted for a stacktrace,
+    // until it is seen stopped.
+    std::chrono::steady_clock::time_point interruptedAt_;
+    // When the thread has been seen stopped for a stacktrace,
+    // until it is resumed.
+    std::chrono::steady_clock::time_point stoppedAt_;
+    // The thread is stopped until it is unwound.
+    bool isStoppedForUnwinding_;
+    // Stopped by job control.
+    bool isInGroupStop_;
+    bool doDetach_;
 };